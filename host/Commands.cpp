@@ -0,0 +1,156 @@
+#include "Commands.h"
+
+#include <sstream>
+#include <stdexcept>
+
+namespace frugal {
+
+using protocol::Argument;
+using protocol::Reply;
+
+namespace {
+
+// Every reply layout of the protocol must have a decoder here.
+constexpr bool hasDecoder(Reply reply)
+{
+    return reply == Reply::None
+        || reply == StatusReply::layout
+        || reply == StatsReply::layout
+        || reply == PingReply::layout
+        || reply == EpochReply::layout
+        || reply == ProfileReply::layout;
+}
+
+constexpr bool allRepliesDecoded()
+{
+    for (auto& command : protocol::commands) {
+        if (!hasDecoder(command.reply))
+            return false;
+    }
+    return true;
+}
+
+static_assert(allRepliesDecoded(), "A reply of the protocol has no decoder.");
+
+bool hasLines(const std::vector<std::string>& lines, Reply layout)
+{
+    return lines.size() == protocol::replyLines(layout);
+}
+
+}
+
+std::string encode(Opcode op, const std::string& argument)
+{
+    const auto& info = protocol::info(op);
+    std::string command = std::string(info.name) + "\r";
+    switch (info.argument) {
+    case Argument::None:
+        if (!argument.empty())
+            throw std::invalid_argument(std::string(info.name) + " takes no argument");
+        return command;
+    case Argument::Number:
+        // A command that replies can be given no number to query the
+        // current value.
+        if (argument.empty() && info.reply != Reply::None)
+            break;
+        if (argument.empty() || argument.size() > info.maxLength
+            || argument.find_first_not_of("0123456789") != std::string::npos
+            || std::stoull(argument) > 0xffffffffULL)
+            throw std::invalid_argument(std::string(info.name) + ": invalid number '"
+                                        + argument + "'");
+        break;
+    case Argument::Text:
+        if (argument.find_first_of("\r\n") != std::string::npos)
+            throw std::invalid_argument(std::string(info.name)
+                                        + ": argument must be a single line");
+        // The firmware would wrap around in its buffer.
+        if (argument.size() > info.maxLength)
+            throw std::invalid_argument(std::string(info.name) + ": argument longer than "
+                                        + std::to_string(info.maxLength) + " characters");
+        break;
+    }
+    return command + argument + "\r";
+}
+
+std::string encode(Opcode op, unsigned long argument)
+{
+    return encode(op, std::to_string(argument));
+}
+
+bool decode(const std::vector<std::string>& lines, StatusReply& reply)
+{
+    if (!hasLines(lines, reply.layout))
+        return false;
+    std::istringstream first(lines[0]);
+    std::string slash;
+    if (!(first >> reply.elapsed >> slash >> reply.timeout) || slash != "/")
+        return false;
+    reply.timestamp = lines[1];
+    return true;
+}
+
+bool decode(const std::vector<std::string>& lines, StatsReply& reply)
+{
+    if (!hasLines(lines, reply.layout))
+        return false;
+    std::istringstream first(lines[0]);
+    if (!(first >> reply.count >> reply.minTicks >> reply.maxTicks))
+        return false;
+    std::istringstream second(lines[1]);
+    reply.buckets.clear();
+    unsigned long bucket;
+    while (second >> bucket)
+        reply.buckets.push_back(bucket);
+    return second.eof() && !reply.buckets.empty();
+}
+
+bool decode(const std::vector<std::string>& lines, PingReply& reply)
+{
+    if (!hasLines(lines, reply.layout))
+        return false;
+    // The argument may contain spaces, the numbers are the last two
+    // words.
+    const std::string& line = lines[0];
+    auto second = line.rfind(' ');
+    auto first = second == std::string::npos || second == 0
+        ? std::string::npos : line.rfind(' ', second - 1);
+    if (first == std::string::npos)
+        return false;
+    std::istringstream numbers(line.substr(first + 1));
+    if (!(numbers >> reply.ticks >> reply.us))
+        return false;
+    reply.argument = line.substr(0, first);
+    return true;
+}
+
+bool decode(const std::vector<std::string>& lines, EpochReply& reply)
+{
+    if (!hasLines(lines, reply.layout))
+        return false;
+    std::istringstream line(lines[0]);
+    return !!(line >> reply.seconds);
+}
+
+bool decode(const std::vector<std::string>& lines, ProfileReply& reply)
+{
+    if (!hasLines(lines, reply.layout))
+        return false;
+    std::istringstream first(lines[0]);
+    if (!(first >> reply.uartIsr.count >> reply.uartIsr.max >> reply.tickIsr.count
+          >> reply.tickIsr.max >> reply.maxIrqOffCycles))
+        return false;
+    // A newer firmware may know more commands than the host.
+    std::istringstream second(lines[1]);
+    reply.commands.clear();
+    ProfileReply::Counter command;
+    while (second >> command.count >> command.max)
+        reply.commands.push_back(command);
+    return second.eof();
+}
+
+bool isError(const std::string& line)
+{
+    return !line.empty() && line.back() == '!';
+}
+
+}
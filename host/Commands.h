@@ -0,0 +1,81 @@
+#ifndef FRUGAL_COMMANDS_H
+#define FRUGAL_COMMANDS_H
+
+#include "Protocol.h"
+
+#include <string>
+#include <vector>
+
+namespace frugal {
+
+using protocol::Opcode;
+
+/*
+  Encoding of commands and decoding of replies, generated from the
+  protocol definition shared with the firmware. Encoding checks the
+  argument against the command's argument type and length and throws
+  std::invalid_argument if it does not fit.
+*/
+std::string encode(Opcode op, const std::string& argument = "");
+std::string encode(Opcode op, unsigned long argument);
+
+struct StatusReply
+{
+    static constexpr protocol::Reply layout = protocol::Reply::Status;
+    unsigned long elapsed;  // Seconds.
+    unsigned long timeout;  // Seconds.
+    std::string timestamp;
+};
+
+struct StatsReply
+{
+    static constexpr protocol::Reply layout = protocol::Reply::Stats;
+    unsigned long count;
+    unsigned long minTicks;
+    unsigned long maxTicks;
+    std::vector<unsigned long> buckets;
+};
+
+struct PingReply
+{
+    static constexpr protocol::Reply layout = protocol::Reply::Ping;
+    std::string argument;
+    unsigned long ticks;
+    unsigned long us;
+};
+
+struct EpochReply
+{
+    static constexpr protocol::Reply layout = protocol::Reply::Epoch;
+    unsigned long seconds;
+};
+
+struct ProfileReply
+{
+    static constexpr protocol::Reply layout = protocol::Reply::Profile;
+    struct Counter
+    {
+        unsigned long count;
+        unsigned long max;  // Cycles for interrupts, microseconds for commands.
+    };
+    Counter uartIsr;
+    Counter tickIsr;
+    unsigned long maxIrqOffCycles;
+    std::vector<Counter> commands;  // By opcode.
+};
+
+// Decode a reply from its lines, without the line terminators. The
+// number of lines must be protocol::replyLines(reply.layout). Returns
+// false if the reply is malformed.
+bool decode(const std::vector<std::string>& lines, StatusReply& reply);
+bool decode(const std::vector<std::string>& lines, StatsReply& reply);
+bool decode(const std::vector<std::string>& lines, PingReply& reply);
+bool decode(const std::vector<std::string>& lines, EpochReply& reply);
+bool decode(const std::vector<std::string>& lines, ProfileReply& reply);
+
+// Error replies of the device end in an exclamation mark.
+bool isError(const std::string& line);
+
+}
+
+#endif
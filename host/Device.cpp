@@ -0,0 +1,472 @@
+#include "Device.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <memory>
+
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <termios.h>
+#include <unistd.h>
+
+namespace frugal {
+
+using Clock = std::chrono::steady_clock;
+
+namespace {
+
+std::error_code errc(std::errc e)
+{
+    return std::make_error_code(e);
+}
+
+int remainingMs(Clock::time_point deadline)
+{
+    auto left = std::chrono::duration_cast<Milliseconds>(deadline - Clock::now()).count();
+    return left > 0 ? left : 0;
+}
+
+enum class Wait { Ready, Timeout, Stop, Gone };
+
+const int reconnectRetryMs = 250;
+
+// Make a future out of a command that has no reply.
+std::future<void> noReply(std::future<Device::Lines> lines)
+{
+    return std::async(std::launch::deferred, [](std::future<Device::Lines> lines) {
+        lines.get();
+    }, std::move(lines));
+}
+
+}
+
+Device::~Device()
+{
+    close();
+}
+
+void Device::open(const std::string& spec, unsigned baud)
+{
+    close();
+    std::string path = findSerialDevice(spec);
+    if (path.empty())
+        throw std::system_error(ENOENT, std::generic_category(), spec);
+    // The trace outlives reopening, so that it covers the outages.
+    if (!tracePath.empty() && !trace_)
+        trace_.reset(new TraceWriter(tracePath, traceLimit, baud));
+    port_.open(path, baud, true);
+    if (reconnectWait.count() > 0) {
+        try {
+            hotplug_.reset(new HotplugMonitor);
+        } catch (std::system_error&) {
+            // Reconnecting falls back to retrying periodically.
+        }
+    }
+    wakeFd_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (wakeFd_ < 0) {
+        int err = errno;
+        port_.close();
+        throw std::system_error(err, std::generic_category(), "eventfd");
+    }
+    spec_ = spec;
+    baud_ = baud;
+    stop_ = false;
+    open_ = true;
+    thread_ = std::thread(&Device::run, this);
+}
+
+void Device::close()
+{
+    if (thread_.joinable()) {
+        {
+            std::lock_guard<std::mutex> guard(mutex_);
+            stop_ = true;
+        }
+        wake();
+        thread_.join();
+    }
+    std::deque<Request> cancelled;
+    {
+        std::lock_guard<std::mutex> guard(mutex_);
+        cancelled.swap(queue_);
+    }
+    fail(cancelled, errc(std::errc::operation_canceled));
+    if (wakeFd_ >= 0)
+        ::close(wakeFd_);
+    wakeFd_ = -1;
+    port_.close();
+    hotplug_.reset();
+    open_ = false;
+}
+
+void Device::wake()
+{
+    uint64_t one = 1;
+    if (write(wakeFd_, &one, sizeof(one)) < 0) {
+        // The counter is already set, the thread will wake up anyway.
+    }
+}
+
+void Device::fail(std::deque<Request>& requests, std::error_code error)
+{
+    for (auto& request : requests)
+        request.done(error, {});
+    requests.clear();
+}
+
+void Device::send(Opcode op, const std::string& argument, Callback done)
+{
+    Request request;
+    request.data = encode(op, argument);
+    request.lines = protocol::replyLines(protocol::info(op).reply);
+    // Setting the epoch has no reply, only asking for it does.
+    if (op == Opcode::epoch && !argument.empty())
+        request.lines = 0;
+    request.done = std::move(done);
+    if (!request.done)
+        request.done = [](std::error_code, const Lines&) {};
+
+    {
+        std::lock_guard<std::mutex> guard(mutex_);
+        if (open_ && !stop_) {
+            // Repeating a command without a reply that is still
+            // waiting only adds to the backlog, e.g. when heartbeats
+            // pile up while the device is reconnecting.
+            if (!request.lines && !queue_.empty() && !queue_.back().lines
+                && queue_.back().data == request.data) {
+                auto first = std::move(queue_.back().done);
+                auto second = std::move(request.done);
+                queue_.back().done = [first, second](std::error_code error, const Lines& lines) {
+                    first(error, lines);
+                    second(error, lines);
+                };
+            } else {
+                queue_.push_back(std::move(request));
+            }
+            request.done = nullptr;
+        }
+    }
+    if (request.done)
+        request.done(errc(std::errc::io_error), {});
+    else
+        wake();
+}
+
+std::future<Device::Lines> Device::send(Opcode op, const std::string& argument)
+{
+    auto promise = std::make_shared<std::promise<Lines>>();
+    send(op, argument, [promise, op](std::error_code error, const Lines& lines) {
+        if (error)
+            promise->set_exception(std::make_exception_ptr(
+                                       std::system_error(error, protocol::info(op).name)));
+        else
+            promise->set_value(lines);
+    });
+    return promise->get_future();
+}
+
+void Device::run()
+{
+    std::string pending;
+
+    // Wait until the port is ready for the given events, or until the
+    // deadline. Waiting for no events only watches for a hangup.
+    auto wait = [&](short events, Clock::time_point deadline, bool forever) {
+        for (;;) {
+            pollfd pfd[2] = { { wakeFd_, POLLIN, 0 }, { port_.fd(), events, 0 } };
+            int r = poll(pfd, 2, forever ? -1 : remainingMs(deadline));
+            if (r < 0) {
+                if (errno == EINTR)
+                    continue;
+                return Wait::Gone;
+            }
+            if (pfd[1].revents & (POLLHUP | POLLERR | POLLNVAL))
+                return Wait::Gone;
+            if (pfd[0].revents & POLLIN) {
+                uint64_t count;
+                if (read(wakeFd_, &count, sizeof(count)) < 0) {
+                    // Nothing to clear.
+                }
+                std::lock_guard<std::mutex> guard(mutex_);
+                if (stop_)
+                    return Wait::Stop;
+                if (forever && !queue_.empty())
+                    return Wait::Ready;
+            }
+            if (pfd[1].revents & events)
+                return Wait::Ready;
+            if (r == 0)
+                return Wait::Timeout;
+        }
+    };
+
+    // Exchange one command with the device.
+    auto exchange = [&](const Request& request, Lines& lines) {
+        // Leave the device time for the command on top of its time on
+        // the wire, ten bits per byte.
+        Milliseconds wire(request.data.size() * 10000 / baud_ + 1);
+        auto deadline = Clock::now() + lockTimeout;
+        for (;;) {
+            if (port_.lock(0))
+                break;
+            if (Clock::now() >= deadline)
+                return errc(std::errc::timed_out);
+            auto w = wait(0, Clock::now() + Milliseconds(5), false);
+            if (w == Wait::Stop)
+                return errc(std::errc::operation_canceled);
+            if (w == Wait::Gone)
+                return errc(std::errc::io_error);
+        }
+        // Anything pending now was meant for someone else.
+        tcflush(port_.fd(), TCIFLUSH);
+        pending.clear();
+
+        std::error_code result;
+        deadline = Clock::now() + wire + replyTimeout;
+        size_t written = 0;
+        while (!result && written < request.data.size()) {
+            ssize_t n = write(port_.fd(), request.data.data() + written,
+                              request.data.size() - written);
+            if (n >= 0) {
+                if (trace_)
+                    trace_->record(Direction::ToDevice, request.data.data() + written, n);
+                written += n;
+                continue;
+            }
+            if (errno == EINTR)
+                continue;
+            if (errno != EAGAIN) {
+                result = errc(std::errc::io_error);
+                break;
+            }
+            switch (wait(POLLOUT, deadline, false)) {
+            case Wait::Ready: break;
+            case Wait::Timeout: result = errc(std::errc::timed_out); break;
+            case Wait::Stop: result = errc(std::errc::operation_canceled); break;
+            case Wait::Gone: result = errc(std::errc::io_error); break;
+            }
+        }
+
+        // A command without a reply succeeds if the device does not
+        // report an error within the gap.
+        deadline = Clock::now() + wire + (request.lines ? replyTimeout : commandGap);
+        while (!result && (!request.lines || lines.size() < request.lines)) {
+            auto eol = pending.find('\n');
+            if (eol != std::string::npos) {
+                std::string line = pending.substr(0, eol);
+                pending.erase(0, eol + 1);
+                if (isError(line))
+                    result = errc(std::errc::invalid_argument);
+                else if (request.lines)
+                    lines.push_back(std::move(line));
+                continue;
+            }
+
+            auto w = wait(POLLIN, deadline, false);
+            if (w == Wait::Timeout) {
+                if (request.lines)
+                    result = errc(std::errc::timed_out);
+                break;
+            }
+            if (w == Wait::Stop) {
+                result = errc(std::errc::operation_canceled);
+                break;
+            }
+            char buf[64];
+            ssize_t n = w == Wait::Ready ? read(port_.fd(), buf, sizeof(buf)) : 0;
+            if (n < 0 && (errno == EINTR || errno == EAGAIN))
+                continue;
+            if (n <= 0) {
+                // The device has gone away.
+                result = errc(std::errc::io_error);
+                break;
+            }
+            if (trace_)
+                trace_->record(Direction::FromDevice, buf, n);
+            for (ssize_t i = 0; i < n; ++i) {
+                if (buf[i] != '\r')
+                    pending += buf[i];
+            }
+        }
+        port_.unlock();
+        if (trace_)
+            trace_->flush();
+        return result;
+    };
+
+    for (;;) {
+        Request request;
+        {
+            std::lock_guard<std::mutex> guard(mutex_);
+            if (stop_)
+                return;
+            if (!queue_.empty()) {
+                request = std::move(queue_.front());
+                queue_.pop_front();
+            }
+        }
+        if (!request.done) {
+            auto w = wait(0, Clock::time_point(), true);
+            if (w == Wait::Stop)
+                return;
+            if (w != Wait::Gone)
+                continue;
+        }
+
+        Lines lines;
+        std::error_code result = request.done
+            ? exchange(request, lines) : errc(std::errc::io_error);
+        if (result == std::errc::io_error) {
+            result = reconnect();
+            if (!result) {
+                // Try the command again on the new port.
+                if (request.done) {
+                    std::lock_guard<std::mutex> guard(mutex_);
+                    queue_.push_front(std::move(request));
+                }
+                continue;
+            }
+        }
+        if (request.done)
+            request.done(result, lines);
+        if (result == std::errc::io_error) {
+            std::deque<Request> failed;
+            {
+                std::lock_guard<std::mutex> guard(mutex_);
+                open_ = false;
+                failed.swap(queue_);
+            }
+            fail(failed, result);
+            return;
+        }
+        if (result == std::errc::operation_canceled)
+            return;
+    }
+}
+
+std::error_code Device::reconnect()
+{
+    port_.close();
+    auto deadline = Clock::now() + reconnectWait;
+    for (;;) {
+        std::string path = findSerialDevice(spec_);
+        if (!path.empty()) {
+            try {
+                port_.open(path, baud_, true);
+                return std::error_code();
+            } catch (std::system_error&) {
+                // Not ready yet.
+            }
+        }
+        if (Clock::now() >= deadline)
+            return errc(std::errc::io_error);
+
+        // Retry when a tty appears, and every so often in case the
+        // events are not available or a by-id link is made late.
+        pollfd pfd[2] = { { wakeFd_, POLLIN, 0 },
+                          { hotplug_ ? hotplug_->fd() : -1, POLLIN, 0 } };
+        int r = poll(pfd, 2, std::min(remainingMs(deadline), reconnectRetryMs));
+        if (r < 0 && errno != EINTR)
+            return errc(std::errc::io_error);
+        if (pfd[0].revents & POLLIN) {
+            uint64_t count;
+            if (read(wakeFd_, &count, sizeof(count)) < 0) {
+                // Nothing to clear.
+            }
+            std::lock_guard<std::mutex> guard(mutex_);
+            if (stop_)
+                return errc(std::errc::operation_canceled);
+        }
+        if (pfd[1].revents & POLLIN)
+            hotplug_->ttyAdded();
+    }
+}
+
+// Adapts a completion to a callback; an empty one stays empty.
+static Device::Callback ignoreLines(Device::Completion done)
+{
+    if (!done)
+        return nullptr;
+    return [done](std::error_code error, const Device::Lines&) { done(error); };
+}
+
+void Device::reset(Completion done, const std::string& timestamp)
+{
+    send(Opcode::reset, timestamp, ignoreLines(std::move(done)));
+}
+
+std::future<void> Device::reset(const std::string& timestamp)
+{
+    return noReply(send(Opcode::reset, timestamp));
+}
+
+void Device::setTimeout(unsigned long seconds, Completion done)
+{
+    send(Opcode::timeout, std::to_string(seconds), ignoreLines(std::move(done)));
+}
+
+std::future<void> Device::setTimeout(unsigned long seconds)
+{
+    return noReply(send(Opcode::timeout, std::to_string(seconds)));
+}
+
+void Device::status(std::function<void(std::error_code, const StatusReply&)> done)
+{
+    if (!done) {
+        send(Opcode::status, "", nullptr);
+        return;
+    }
+    send(Opcode::status, "", [done](std::error_code error, const Lines& lines) {
+        StatusReply reply{};
+        if (!error && !decode(lines, reply))
+            error = errc(std::errc::bad_message);
+        done(error, reply);
+    });
+}
+
+std::future<StatusReply> Device::status()
+{
+    auto promise = std::make_shared<std::promise<StatusReply>>();
+    status([promise](std::error_code error, const StatusReply& reply) {
+        if (error)
+            promise->set_exception(std::make_exception_ptr(std::system_error(error, "status")));
+        else
+            promise->set_value(reply);
+    });
+    return promise->get_future();
+}
+
+LoopHeartbeat::LoopHeartbeat(Device& device, Milliseconds interval,
+                             Device::Completion onError)
+    : device_(device), interval_(interval), onError_(std::move(onError))
+{
+    thread_ = std::thread(&LoopHeartbeat::run, this);
+}
+
+LoopHeartbeat::~LoopHeartbeat()
+{
+    {
+        std::lock_guard<std::mutex> guard(mutex_);
+        stop_ = true;
+    }
+    wake_.notify_all();
+    thread_.join();
+}
+
+void LoopHeartbeat::run()
+{
+    auto next = Clock::now() + interval_;
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!wake_.wait_until(lock, next, [this] { return stop_; })) {
+        next += interval_;
+        if (!alive_.exchange(false, std::memory_order_relaxed))
+            continue;
+        auto onError = onError_;
+        device_.reset([onError](std::error_code error) {
+            if (error && onError)
+                onError(error);
+        });
+    }
+}
+
+}
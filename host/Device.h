@@ -0,0 +1,173 @@
+#ifndef FRUGAL_DEVICE_H
+#define FRUGAL_DEVICE_H
+
+#include "Commands.h"
+#include "Hotplug.h"
+#include "SerialPort.h"
+#include "Trace.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+namespace frugal {
+
+using Milliseconds = std::chrono::milliseconds;
+
+/*
+  Asynchronous client for the watchdog, meant to be embedded into
+  services. Commands are queued and return immediately; a thread of
+  the Device writes them out one at a time, paced so that the device
+  can keep up, and collects the replies. Each command completes either
+  through a callback or a future.
+
+  Callbacks are called from the Device's thread and must not block or
+  call close(). An empty callback discards the result. Errors are
+  passed as std::error_code, or as std::system_error through futures:
+
+    timed_out           no reply, or the port stayed locked
+    invalid_argument    the device reported an error
+    bad_message         the reply could not be decoded
+    io_error            the device has gone away and must be reopened
+    operation_canceled  the Device was closed
+
+  The port is locked with flock() around each command, so the
+  frugal_watchdog script can be used alongside. A command without a
+  reply that repeats the last one still queued is merged with it.
+*/
+class Device
+{
+ public:
+    using Lines = std::vector<std::string>;
+    using Callback = std::function<void(std::error_code, const Lines&)>;
+    using Completion = std::function<void(std::error_code)>;
+
+    Device() = default;
+    ~Device();
+
+    Device(const Device&) = delete;
+    Device& operator=(const Device&) = delete;
+
+    // Open the port without blocking and start the thread. The
+    // device is given as a path or a USB serial number, see
+    // findSerialDevice(). Throws std::system_error.
+    void open(const std::string& spec, unsigned baud = 2400);
+
+    // Stop the thread and cancel the queued commands.
+    void close();
+
+    // False if the device has not been opened or has gone away for
+    // longer than reconnectWait.
+    bool isOpen() const {
+        return open_;
+    }
+
+    // Queue a raw command and pass the lines of its reply to done.
+    // The argument is checked as by encode(), which may throw. If the
+    // device is not open, done is called right away with io_error.
+    void send(Opcode op, const std::string& argument, Callback done);
+    std::future<Lines> send(Opcode op, const std::string& argument = "");
+
+    void reset(Completion done, const std::string& timestamp = "");
+    std::future<void> reset(const std::string& timestamp = "");
+
+    void setTimeout(unsigned long seconds, Completion done);
+    std::future<void> setTimeout(unsigned long seconds);
+
+    void status(std::function<void(std::error_code, const StatusReply&)> done);
+    std::future<StatusReply> status();
+
+    // How long to wait for a reply, on top of the time on the wire.
+    Milliseconds replyTimeout{1000};
+    // How long the device is given to handle a command without a
+    // reply, and to report an error for it.
+    Milliseconds commandGap{100};
+    // How long to wait for the port to be unlocked.
+    Milliseconds lockTimeout{1000};
+    // How long to wait for the device to come back after it has gone
+    // away, e.g. when the USB-serial converter re-enumerates. The
+    // port is reopened as soon as a tty appears, and the command that
+    // was interrupted is sent again. Zero fails right away. Set it
+    // before open().
+    Milliseconds reconnectWait{0};
+    // If set, the traffic is recorded to this file, see Trace.h, using
+    // at most traceLimit bytes of disk. Set it before open().
+    std::string tracePath;
+    size_t traceLimit = 1 << 20;
+
+ private:
+    struct Request
+    {
+        std::string data;
+        size_t lines;
+        Callback done;
+    };
+
+    void run();
+    void wake();
+    void fail(std::deque<Request>& requests, std::error_code error);
+    std::error_code reconnect();
+
+    SerialPort port_;
+    std::string spec_;
+    unsigned baud_ = 0;
+    std::unique_ptr<HotplugMonitor> hotplug_;
+    std::unique_ptr<TraceWriter> trace_;
+    std::atomic<bool> open_{false};
+    int wakeFd_ = -1;
+
+    std::mutex mutex_;
+    std::deque<Request> queue_;
+    bool stop_ = false;
+    std::thread thread_;
+};
+
+/*
+  Ties heartbeats to the liveness of an event loop. The loop calls
+  alive() regularly, e.g. from a timer of its own. Every interval, a
+  heartbeat is sent if alive() has been called since the previous one.
+  Should the loop deadlock, the heartbeats stop and the watchdog resets
+  the machine. Calling alive() costs an atomic store; a heartbeat costs
+  one write to the port.
+*/
+class LoopHeartbeat
+{
+ public:
+    // Errors of the heartbeats are passed to onError, if given.
+    LoopHeartbeat(Device& device, Milliseconds interval,
+                  Device::Completion onError = nullptr);
+    ~LoopHeartbeat();
+
+    LoopHeartbeat(const LoopHeartbeat&) = delete;
+    LoopHeartbeat& operator=(const LoopHeartbeat&) = delete;
+
+    void alive() {
+        alive_.store(true, std::memory_order_relaxed);
+    }
+
+ private:
+    void run();
+
+    Device& device_;
+    Milliseconds interval_;
+    Device::Completion onError_;
+    std::atomic<bool> alive_{false};
+
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    bool stop_ = false;
+    std::thread thread_;
+};
+
+}
+
+#endif
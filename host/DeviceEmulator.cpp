@@ -0,0 +1,210 @@
+#include "DeviceEmulator.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+namespace frugal {
+
+using protocol::Argument;
+using protocol::Opcode;
+
+// Tick lengths and clock resolutions of the firmware.
+using protocol::attinyTickUs;
+using protocol::atmegaTickUs;
+using protocol::attinyCountUs;
+using protocol::atmegaCountUs;
+
+// The firmware's command buffer.
+static const size_t maxLine = 16;
+
+DeviceEmulator::DeviceEmulator(bool atmega)
+    : tickUs_(atmega ? atmegaTickUs : attinyTickUs)
+{
+}
+
+// The ticks come from a clock that runs since power-on, so these are
+// the ticks that fell between the two times.
+unsigned long DeviceEmulator::ticksSince(uint64_t since, uint64_t us) const
+{
+    return us > since ? tickIndex(us) - tickIndex(since) : 0;
+}
+
+uint64_t DeviceEmulator::tickIndex(uint64_t us) const
+{
+    return us > powerOn_ ? (us - powerOn_) / tickUs_ : 0;
+}
+
+unsigned long DeviceEmulator::timeoutTicks() const
+{
+    unsigned long unit = tickUs_ / 64;
+    return (timeoutSeconds_ * (1000000 / 64) + unit - 1) / unit;
+}
+
+uint64_t DeviceEmulator::deadline() const
+{
+    // The firmware resets the machine on the tick after the last one.
+    if (!running_)
+        return 0;
+    return powerOn_ + (tickIndex(countdownStart_) + timeoutTicks() + 1) * tickUs_;
+}
+
+bool DeviceEmulator::expire(uint64_t us)
+{
+    if (!running_ || us < deadline())
+        return false;
+    running_ = false;
+    ++timeouts_;
+    if (timestamp_.empty() && epochSeconds_)
+        timestamp_ = std::to_string(epochSeconds_ + (us - epochSetAt_) / 1000000);
+    storedTimestamp_ = timestamp_;
+    // The countdown stays at the timeout, for status to show.
+    stoppedTicks_ = timeoutTicks();
+    return true;
+}
+
+void DeviceEmulator::input(const char* data, size_t size, uint64_t us, std::string& reply)
+{
+    if (!powerOn_)
+        powerOn_ = us;
+    // Time passes between the bytes as well.
+    expire(us);
+    for (size_t i = 0; i < size; ++i) {
+        char c = data[i];
+        if (c == '\n')
+            continue;
+        if (c != '\r') {
+            if (line_.size() < maxLine)
+                line_ += c;
+            else
+                line_ = std::string(1, c);
+            continue;
+        }
+
+        std::string line;
+        line.swap(line_);
+        if (pending_ >= 0) {
+            Opcode op = (Opcode)pending_;
+            pending_ = -1;
+            execute(op, line, us, reply);
+            // A command keeps the firmware busy while it waits for its
+            // argument.
+            commandUs_[(int)op] = std::max(commandUs_[(int)op], us - commandStart_);
+            continue;
+        }
+        int found = -1;
+        for (int k = 0; k < protocol::commandCount; ++k) {
+            if (line == protocol::commands[k].name)
+                found = k;
+        }
+        if (found < 0)
+            reply += "Invalid command!\n\r";
+        else if (protocol::commands[found].argument != Argument::None) {
+            pending_ = found;
+            commandStart_ = us;
+        }
+        else
+            execute((Opcode)found, "", us, reply);
+    }
+}
+
+void DeviceEmulator::execute(Opcode op, const std::string& argument, uint64_t us,
+                             std::string& reply)
+{
+    unsigned long elapsed = running_ ? ticksSince(countdownStart_, us) : stoppedTicks_;
+    switch (op) {
+    case Opcode::timeout:
+        timeoutSeconds_ = strtol(argument.c_str(), nullptr, 0);
+        break;
+    case Opcode::reset:
+        timestamp_ = argument.substr(0, protocol::info(op).maxLength);
+        ++heartbeats_;
+        lastHeartbeat_ = us;
+        if (running_) {
+            int bucket = 0;
+            for (unsigned long e = elapsed; e && bucket < statsBuckets - 1; e >>= 1)
+                ++bucket;
+            ++stats_[bucket];
+            if (elapsed < statsMin_)
+                statsMin_ = elapsed;
+            if (elapsed > statsMax_)
+                statsMax_ = elapsed;
+        }
+        stoppedTicks_ = 0;
+        elapsed = 0;
+        // Reset also starts the watchdog.
+        [[fallthrough]];
+    case Opcode::start:
+        if (!timeoutTicks())
+            break;
+        if (!running_ || op == Opcode::reset)
+            countdownStart_ = us - elapsed * tickUs_;
+        running_ = true;
+        break;
+    case Opcode::stop:
+        if (running_)
+            stoppedTicks_ = elapsed;
+        running_ = false;
+        break;
+    case Opcode::status:
+        reply += std::to_string(elapsed * (tickUs_ / 64) / (1000000 / 64)) + " / "
+            + std::to_string(timeoutTicks() * (tickUs_ / 64) / (1000000 / 64)) + "\r\n"
+            + storedTimestamp_ + "\r\n";
+        break;
+    case Opcode::clearmem:
+        timeoutSeconds_ = 60;
+        storedTimestamp_.clear();
+        statsMin_ = ~0UL;
+        statsMax_ = 0;
+        memset(stats_, 0, sizeof(stats_));
+        break;
+    case Opcode::stats: {
+        unsigned long count = 0;
+        for (auto bucket : stats_)
+            count += bucket;
+        reply += std::to_string(count) + " " + std::to_string(count ? statsMin_ : 0)
+            + " " + std::to_string(statsMax_) + "\r\n";
+        for (int i = 0; i < statsBuckets; ++i)
+            reply += (i ? " " : "") + std::to_string(stats_[i]);
+        reply += "\r\n";
+        break;
+    }
+    case Opcode::ping: {
+        uint64_t countUs = tickUs_ == attinyTickUs ? attinyCountUs : atmegaCountUs;
+        uint64_t since = us - powerOn_;
+        uint64_t within = since % tickUs_;
+        reply += argument.substr(0, protocol::info(op).maxLength) + " " + std::to_string(since / tickUs_) + " "
+            + std::to_string(within - within % countUs) + "\r\n";
+        break;
+    }
+    case Opcode::clock:
+    case Opcode::pulse:
+        // Calibration and pulse patterns do not matter to the host.
+        break;
+    case Opcode::epoch: {
+        unsigned long seconds = strtoul(argument.c_str(), nullptr, 10);
+        if (seconds) {
+            epochSeconds_ = seconds;
+            epochSetAt_ = us;
+        } else {
+            reply += std::to_string(epochSeconds_
+                                    ? epochSeconds_ + (us - epochSetAt_) / 1000000 : 0)
+                + "\r\n";
+        }
+        break;
+    }
+    case Opcode::prof:
+        // There are no interrupts to measure.
+        reply += "0 0 0 0 0\r\n";
+        for (int i = 0; i < protocol::commandCount; ++i) {
+            reply += (i ? " " : "") + std::to_string(commandCounts_[i]) + " "
+                + std::to_string(commandUs_[i]);
+        }
+        reply += "\r\n";
+        break;
+    }
+    // As in the firmware, a command is counted once it has finished.
+    ++commandCounts_[(int)op];
+}
+
+}
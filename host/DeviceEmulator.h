@@ -0,0 +1,98 @@
+#ifndef FRUGAL_DEVICE_EMULATOR_H
+#define FRUGAL_DEVICE_EMULATOR_H
+
+#include "Protocol.h"
+
+#include <cstdint>
+#include <string>
+
+namespace frugal {
+
+/*
+  A model of the firmware, for exercising host tools without a device.
+  It parses commands the way the firmware does, keeps the countdown in
+  ticks of the nominal length, and answers status, stats, ping and
+  epoch in the same format.
+
+  The emulator does no I/O of its own. Bytes from the host are fed to
+  input() with the time they arrived, and the replies are returned for
+  the caller to send. Times are in microseconds on any monotonic clock.
+  The emulator answers prof like a firmware built with profiling.
+*/
+class DeviceEmulator
+{
+ public:
+    explicit DeviceEmulator(bool atmega = false);
+
+    // Handle bytes received at time us and append the replies.
+    void input(const char* data, size_t size, uint64_t us, std::string& reply);
+
+    // Run the countdown up to time us. Returns true if it expired, in
+    // which case the device would now reset the machine and stops, as
+    // the firmware does.
+    bool expire(uint64_t us);
+
+    // When the countdown expires, if it is running.
+    uint64_t deadline() const;
+
+    bool running() const {
+        return running_;
+    }
+
+    unsigned long timeoutSeconds() const {
+        return timeoutSeconds_;
+    }
+
+    unsigned long heartbeats() const {
+        return heartbeats_;
+    }
+
+    unsigned long timeouts() const {
+        return timeouts_;
+    }
+
+    // When the last heartbeat arrived.
+    uint64_t lastHeartbeat() const {
+        return lastHeartbeat_;
+    }
+
+ private:
+    void execute(protocol::Opcode op, const std::string& argument, uint64_t us,
+                 std::string& reply);
+    unsigned long ticksSince(uint64_t since, uint64_t us) const;
+    uint64_t tickIndex(uint64_t us) const;
+    unsigned long timeoutTicks() const;
+
+    static constexpr int statsBuckets = 12;
+
+    uint64_t tickUs_;
+    std::string line_;
+    int pending_ = -1;  // Command waiting for its argument line.
+
+    unsigned long timeoutSeconds_ = 60;
+    bool running_ = false;
+    uint64_t powerOn_ = 0;
+    uint64_t lastHeartbeat_ = 0;
+    uint64_t countdownStart_ = 0;
+    unsigned long stoppedTicks_ = 0;  // The countdown while stopped.
+    std::string timestamp_;        // Of the last heartbeat.
+    std::string storedTimestamp_;  // Of the last timeout.
+    unsigned long heartbeats_ = 0;
+    unsigned long timeouts_ = 0;
+
+    uint64_t epochSeconds_ = 0;  // At epochSetAt_.
+    uint64_t epochSetAt_ = 0;
+
+    // Commands that take an argument last until it arrives.
+    uint64_t commandStart_ = 0;
+    unsigned long commandCounts_[protocol::commandCount] = {};
+    uint64_t commandUs_[protocol::commandCount] = {};
+
+    unsigned long statsMin_ = ~0UL;
+    unsigned long statsMax_ = 0;
+    unsigned long stats_[statsBuckets] = {};
+};
+
+}
+
+#endif
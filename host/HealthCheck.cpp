@@ -0,0 +1,386 @@
+#include "HealthCheck.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <stdexcept>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace frugal {
+
+using Clock = std::chrono::steady_clock;
+
+namespace {
+
+class LoadCheck : public HealthCheck
+{
+ public:
+    LoadCheck(const std::string& name, Milliseconds deadline, double max)
+        : HealthCheck(name, deadline), max_(max) {}
+
+    bool run(std::string& why) override {
+        double load;
+        if (getloadavg(&load, 1) != 1) {
+            why = "cannot read load average";
+            return false;
+        }
+        if (load > max_) {
+            why = "load is " + std::to_string(load);
+            return false;
+        }
+        return true;
+    }
+
+ private:
+    double max_;
+};
+
+class MemoryCheck : public HealthCheck
+{
+ public:
+    MemoryCheck(const std::string& name, Milliseconds deadline,
+                unsigned long minMiB)
+        : HealthCheck(name, deadline), minKiB_(minMiB * 1024) {}
+
+    bool run(std::string& why) override {
+        std::ifstream meminfo("/proc/meminfo");
+        std::string key;
+        unsigned long kib;
+        std::string unit;
+        while (meminfo >> key >> kib >> unit) {
+            if (key != "MemAvailable:")
+                continue;
+            if (kib < minKiB_) {
+                why = std::to_string(kib / 1024) + " MiB available";
+                return false;
+            }
+            return true;
+        }
+        why = "cannot read available memory";
+        return false;
+    }
+
+ private:
+    unsigned long minKiB_;
+};
+
+class FileCheck : public HealthCheck
+{
+ public:
+    FileCheck(const std::string& name, Milliseconds deadline,
+              const std::string& path, time_t maxAge)
+        : HealthCheck(name, deadline), path_(path), maxAge_(maxAge) {}
+
+    bool run(std::string& why) override {
+        struct stat st;
+        if (stat(path_.c_str(), &st) < 0) {
+            why = strerror(errno);
+            return false;
+        }
+        time_t age = time(nullptr) - st.st_mtime;
+        if (age > maxAge_) {
+            why = "last modified " + std::to_string(age) + " s ago";
+            return false;
+        }
+        return true;
+    }
+
+ private:
+    std::string path_;
+    time_t maxAge_;
+};
+
+class ProcessCheck : public HealthCheck
+{
+ public:
+    ProcessCheck(const std::string& name, Milliseconds deadline,
+                 const std::string& process)
+        // The kernel truncates process names to 15 characters.
+        : HealthCheck(name, deadline), process_(process.substr(0, 15)) {}
+
+    bool run(std::string& why) override {
+        DIR* proc = opendir("/proc");
+        if (!proc) {
+            why = strerror(errno);
+            return false;
+        }
+        bool found = false;
+        while (dirent* entry = readdir(proc)) {
+            if (entry->d_name[0] < '0' || entry->d_name[0] > '9')
+                continue;
+            std::string path = std::string("/proc/") + entry->d_name + "/comm";
+            std::ifstream comm(path);
+            std::string line;
+            if (std::getline(comm, line) && line == process_) {
+                found = true;
+                break;
+            }
+        }
+        closedir(proc);
+        if (!found)
+            why = "not running";
+        return found;
+    }
+
+ private:
+    std::string process_;
+};
+
+class TcpCheck : public HealthCheck
+{
+ public:
+    TcpCheck(const std::string& name, Milliseconds deadline,
+             const std::string& host, const std::string& port)
+        : HealthCheck(name, deadline) {
+        // Resolve the address once, name lookups may take forever.
+        addrinfo hints = {};
+        hints.ai_socktype = SOCK_STREAM;
+        addrinfo* res;
+        int err = getaddrinfo(host.c_str(), port.c_str(), &hints, &res);
+        if (err)
+            throw std::invalid_argument(name + ": " + gai_strerror(err));
+        family_ = res->ai_family;
+        memcpy(&addr_, res->ai_addr, res->ai_addrlen);
+        addrlen_ = res->ai_addrlen;
+        freeaddrinfo(res);
+    }
+
+    bool run(std::string& why) override {
+        int fd = socket(family_, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd < 0) {
+            why = strerror(errno);
+            return false;
+        }
+        bool ok = false;
+        if (0 == connect(fd, (sockaddr*)&addr_, addrlen_)) {
+            ok = true;
+        } else if (errno != EINPROGRESS) {
+            why = strerror(errno);
+        } else {
+            pollfd pfd = { fd, POLLOUT, 0 };
+            int r = poll(&pfd, 1, deadline().count());
+            int err = 0;
+            socklen_t len = sizeof(err);
+            if (r == 0) {
+                why = "connection timed out";
+            } else if (r < 0 || getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0) {
+                why = strerror(errno);
+            } else if (err) {
+                why = strerror(err);
+            } else {
+                ok = true;
+            }
+        }
+        close(fd);
+        return ok;
+    }
+
+ private:
+    int family_;
+    sockaddr_storage addr_;
+    socklen_t addrlen_;
+};
+
+std::vector<std::string> split(const std::string& s, char sep, size_t maxParts)
+{
+    std::vector<std::string> parts;
+    size_t start = 0;
+    while (parts.size() + 1 < maxParts) {
+        size_t pos = s.find(sep, start);
+        if (pos == std::string::npos)
+            break;
+        parts.push_back(s.substr(start, pos - start));
+        start = pos + 1;
+    }
+    parts.push_back(s.substr(start));
+    return parts;
+}
+
+unsigned long toNumber(const std::string& spec, const std::string& s)
+{
+    char* end;
+    errno = 0;
+    unsigned long n = strtoul(s.c_str(), &end, 10);
+    if (s.empty() || *end || errno)
+        throw std::invalid_argument(spec + ": invalid number '" + s + "'");
+    return n;
+}
+
+}
+
+std::unique_ptr<HealthCheck> HealthCheck::parse(const std::string& spec,
+                                                Milliseconds defaultDeadline)
+{
+    std::string body = spec;
+    Milliseconds deadline = defaultDeadline;
+    auto at = body.rfind('@');
+    if (at != std::string::npos) {
+        deadline = Milliseconds(toNumber(spec, body.substr(at + 1)));
+        body.erase(at);
+    }
+
+    auto parts = split(body, ':', 2);
+    const std::string& kind = parts[0];
+    const std::string args = parts.size() > 1 ? parts[1] : "";
+
+    if (kind == "load") {
+        char* end;
+        double max = strtod(args.c_str(), &end);
+        if (args.empty() || *end)
+            throw std::invalid_argument(spec + ": invalid load");
+        return std::unique_ptr<HealthCheck>(new LoadCheck(spec, deadline, max));
+    } else if (kind == "mem") {
+        return std::unique_ptr<HealthCheck>(
+            new MemoryCheck(spec, deadline, toNumber(spec, args)));
+    } else if (kind == "file") {
+        auto colon = args.rfind(':');
+        if (colon == std::string::npos || colon == 0)
+            throw std::invalid_argument(spec + ": expected file:<path>:<seconds>");
+        return std::unique_ptr<HealthCheck>(
+            new FileCheck(spec, deadline, args.substr(0, colon),
+                          toNumber(spec, args.substr(colon + 1))));
+    } else if (kind == "proc") {
+        if (args.empty())
+            throw std::invalid_argument(spec + ": expected proc:<name>");
+        return std::unique_ptr<HealthCheck>(new ProcessCheck(spec, deadline, args));
+    } else if (kind == "tcp") {
+        auto colon = args.rfind(':');
+        if (colon == std::string::npos || colon == 0)
+            throw std::invalid_argument(spec + ": expected tcp:<host>:<port>");
+        std::string host = args.substr(0, colon);
+        // Allow IPv6 addresses in brackets.
+        if (host.size() > 1 && host.front() == '[' && host.back() == ']')
+            host = host.substr(1, host.size() - 2);
+        return std::unique_ptr<HealthCheck>(
+            new TcpCheck(spec, deadline, host, args.substr(colon + 1)));
+    }
+    throw std::invalid_argument(spec + ": unknown check");
+}
+
+
+HealthEngine::HealthEngine(std::vector<std::unique_ptr<HealthCheck>> checks)
+    : shared_(std::make_shared<Shared>())
+{
+    shared_->slots.resize(checks.size());
+    for (size_t i = 0; i < checks.size(); ++i)
+        shared_->slots[i].check = std::move(checks[i]);
+    for (size_t i = 0; i < shared_->slots.size(); ++i)
+        threads_.emplace_back(work, shared_, i);
+}
+
+HealthEngine::~HealthEngine()
+{
+    std::vector<bool> busy;
+    {
+        std::lock_guard<std::mutex> lock(shared_->mutex);
+        shared_->stop = true;
+        for (auto& slot : shared_->slots)
+            busy.push_back(slot.requested != slot.finished);
+    }
+    shared_->wake.notify_all();
+    // A thread stuck in a check cannot be interrupted. It keeps the
+    // shared state alive and exits once the check returns.
+    for (size_t i = 0; i < threads_.size(); ++i) {
+        if (busy[i])
+            threads_[i].detach();
+        else
+            threads_[i].join();
+    }
+}
+
+void HealthEngine::work(std::shared_ptr<Shared> shared, size_t index)
+{
+    std::unique_lock<std::mutex> lock(shared->mutex);
+    Slot& slot = shared->slots[index];
+    for (;;) {
+        shared->wake.wait(lock, [&] {
+            return shared->stop || slot.requested != slot.finished;
+        });
+        if (shared->stop)
+            return;
+
+        unsigned long round = slot.requested;
+        lock.unlock();
+        std::string why;
+        bool ok;
+        try {
+            ok = slot.check->run(why);
+        } catch (std::exception& e) {
+            ok = false;
+            why = e.what();
+        }
+        lock.lock();
+
+        slot.ok = ok;
+        slot.why = std::move(why);
+        slot.finishedAt = Clock::now();
+        slot.finished = round;
+        shared->done.notify_all();
+    }
+}
+
+bool HealthEngine::runRound(Milliseconds budget,
+                            std::vector<std::string>& failures)
+{
+    failures.clear();
+    auto start = Clock::now();
+    auto end = start + budget;
+    ++round_;
+
+    std::unique_lock<std::mutex> lock(shared_->mutex);
+    auto& slots = shared_->slots;
+    std::vector<bool> started(slots.size());
+    for (size_t i = 0; i < slots.size(); ++i) {
+        Slot& slot = slots[i];
+        if (slot.requested != slot.finished) {
+            failures.push_back(slot.check->name()
+                               + ": still running since an earlier round");
+            continue;
+        }
+        slot.requested = round_;
+        started[i] = true;
+    }
+    shared_->wake.notify_all();
+
+    // Wait for the checks to finish. Once the earliest deadline among
+    // the ones that are still running has passed, the round has
+    // failed and there is no point in waiting any longer.
+    for (;;) {
+        bool pending = false;
+        auto wakeup = end;
+        for (size_t i = 0; i < slots.size(); ++i) {
+            if (started[i] && slots[i].finished != round_) {
+                pending = true;
+                wakeup = std::min(wakeup, start + slots[i].check->deadline());
+            }
+        }
+        if (!pending || Clock::now() >= wakeup)
+            break;
+        shared_->done.wait_until(lock, wakeup);
+    }
+
+    for (size_t i = 0; i < slots.size(); ++i) {
+        if (!started[i])
+            continue;
+        const Slot& slot = slots[i];
+        const std::string& name = slot.check->name();
+        auto limit = start + std::min<Clock::duration>(slot.check->deadline(), budget);
+        if (slot.finished != round_ || slot.finishedAt > limit)
+            failures.push_back(name + ": deadline exceeded");
+        else if (!slot.ok)
+            failures.push_back(name + ": " + slot.why);
+    }
+    return failures.empty();
+}
+
+}
@@ -0,0 +1,113 @@
+#ifndef FRUGAL_HEALTH_CHECK_H
+#define FRUGAL_HEALTH_CHECK_H
+
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace frugal {
+
+using Milliseconds = std::chrono::milliseconds;
+
+/*
+  A single health check. Checks are created from a textual spec of
+  the form "kind:arguments[@deadline]", where the deadline is given in
+  milliseconds:
+
+    load:<max>                   1-minute load average at most max
+    mem:<MiB>                    at least this much memory available
+    file:<path>:<seconds>        path modified at most this long ago
+    proc:<name>                  a process with this name is running
+    tcp:<host>:<port>            a TCP connection can be made
+
+  Errors in the spec are reported by throwing std::invalid_argument.
+*/
+class HealthCheck
+{
+ public:
+    virtual ~HealthCheck() = default;
+
+    static std::unique_ptr<HealthCheck> parse(const std::string& spec,
+                                              Milliseconds defaultDeadline);
+
+    // Perform the check. Returns true if the system is healthy,
+    // otherwise sets why to a short explanation. May block, but
+    // should try not to exceed the deadline.
+    virtual bool run(std::string& why) = 0;
+
+    const std::string& name() const {
+        return name_;
+    }
+
+    Milliseconds deadline() const {
+        return deadline_;
+    }
+
+ protected:
+    HealthCheck(const std::string& name, Milliseconds deadline)
+        : name_(name), deadline_(deadline) {}
+
+ private:
+    std::string name_;
+    Milliseconds deadline_;
+};
+
+/*
+  Runs health checks concurrently. Each check gets its own thread
+  which stays around between rounds, so starting a round costs a
+  notification instead of a fork. A round is over when all checks
+  have finished, or when their deadlines or the round's budget run
+  out, whichever comes first. A check that is still stuck from an
+  earlier round counts as failed and is not started again until it
+  returns, so hung checks do not pile up threads.
+*/
+class HealthEngine
+{
+ public:
+    explicit HealthEngine(std::vector<std::unique_ptr<HealthCheck>> checks);
+    ~HealthEngine();
+
+    HealthEngine(const HealthEngine&) = delete;
+    HealthEngine& operator=(const HealthEngine&) = delete;
+
+    // Run a round and wait for at most budget. Returns true if all
+    // checks passed within their deadlines. The reasons for failures
+    // are stored into failures.
+    bool runRound(Milliseconds budget, std::vector<std::string>& failures);
+
+ private:
+    struct Slot
+    {
+        std::unique_ptr<HealthCheck> check;
+        unsigned long requested = 0;
+        unsigned long finished = 0;
+        bool ok = false;
+        std::string why;
+        std::chrono::steady_clock::time_point finishedAt;
+    };
+
+    // Shared with the worker threads, which may outlive the engine if
+    // they are stuck in a check.
+    struct Shared
+    {
+        std::mutex mutex;
+        std::condition_variable wake;
+        std::condition_variable done;
+        bool stop = false;
+        std::vector<Slot> slots;
+    };
+
+    static void work(std::shared_ptr<Shared> shared, size_t index);
+
+    std::shared_ptr<Shared> shared_;
+    std::vector<std::thread> threads_;
+    unsigned long round_ = 0;
+};
+
+}
+
+#endif
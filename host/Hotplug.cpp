@@ -0,0 +1,110 @@
+#include "Hotplug.h"
+
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <system_error>
+
+#include <dirent.h>
+#include <linux/netlink.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace frugal {
+
+// Walk up from the tty's device in sysfs to the USB device, which has
+// the serial number.
+static bool hasUsbSerial(const std::string& tty, const std::string& serial)
+{
+    char resolved[PATH_MAX];
+    std::string link = "/sys/class/tty/" + tty + "/device";
+    if (!realpath(link.c_str(), resolved))
+        return false;
+    std::string dir = resolved;
+    while (dir.size() > sizeof("/sys/devices")) {
+        std::ifstream file(dir + "/serial");
+        std::string value;
+        if (file && std::getline(file, value))
+            return value == serial;
+        dir.erase(dir.rfind('/'));
+    }
+    return false;
+}
+
+std::string findSerialDevice(const std::string& spec)
+{
+    if (spec.compare(0, 4, "usb:") != 0)
+        return access(spec.c_str(), F_OK) == 0 ? spec : std::string();
+
+    std::string serial = spec.substr(4);
+    DIR* dir = opendir("/sys/class/tty");
+    if (!dir)
+        return std::string();
+    std::string found;
+    while (dirent* entry = readdir(dir)) {
+        if (entry->d_name[0] != '.' && hasUsbSerial(entry->d_name, serial)) {
+            found = std::string("/dev/") + entry->d_name;
+            break;
+        }
+    }
+    closedir(dir);
+    return found;
+}
+
+HotplugMonitor::HotplugMonitor()
+{
+    fd_ = socket(AF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                 NETLINK_KOBJECT_UEVENT);
+    if (fd_ < 0)
+        throw std::system_error(errno, std::generic_category(), "netlink");
+    // Group 1 has the kernel's events, which come first. Group 2 has
+    // udev's, which come after the /dev/serial/by-id links are made.
+    sockaddr_nl addr = {};
+    addr.nl_family = AF_NETLINK;
+    addr.nl_groups = 1 | 2;
+    if (bind(fd_, (sockaddr*)&addr, sizeof(addr)) < 0) {
+        int err = errno;
+        ::close(fd_);
+        fd_ = -1;
+        throw std::system_error(err, std::generic_category(), "netlink");
+    }
+}
+
+HotplugMonitor::~HotplugMonitor()
+{
+    if (fd_ >= 0)
+        ::close(fd_);
+}
+
+bool HotplugMonitor::ttyAdded()
+{
+    bool added = false;
+    char buf[4096];
+    for (;;) {
+        ssize_t n = recv(fd_, buf, sizeof(buf) - 1, 0);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == ENOBUFS)
+                added = true;
+            else
+                break;
+            continue;
+        }
+        // Both kinds of events carry their properties as KEY=value
+        // strings separated by NULs; udev's are preceded by a binary
+        // header that does not matter here.
+        buf[n] = 0;
+        bool add = false, tty = false;
+        for (const char* p = buf; p < buf + n; p += strlen(p) + 1) {
+            add = add || !strcmp(p, "ACTION=add");
+            tty = tty || !strcmp(p, "SUBSYSTEM=tty");
+        }
+        added = added || (add && tty);
+    }
+    return added;
+}
+
+}
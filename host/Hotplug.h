@@ -0,0 +1,51 @@
+#ifndef FRUGAL_HOTPLUG_H
+#define FRUGAL_HOTPLUG_H
+
+#include <string>
+
+namespace frugal {
+
+/*
+  Finding the watchdog when its USB-serial converter comes and goes.
+
+  A device is named either by a path, preferably a stable one under
+  /dev/serial/by-id/, or as "usb:<serial>" with the USB serial number
+  of the converter, which is looked up in sysfs. The name is resolved
+  anew every time the port is opened, so it keeps working when the
+  converter re-enumerates as a different ttyUSB.
+*/
+
+// The tty currently named by spec, or an empty string if it is not
+// present.
+std::string findSerialDevice(const std::string& spec);
+
+/*
+  Watches kernel and udev uevents for tty devices appearing. The
+  descriptor can be polled for POLLIN; ttyAdded() then drains the
+  pending events. Throws std::system_error if the netlink socket
+  cannot be opened.
+*/
+class HotplugMonitor
+{
+ public:
+    HotplugMonitor();
+    ~HotplugMonitor();
+
+    HotplugMonitor(const HotplugMonitor&) = delete;
+    HotplugMonitor& operator=(const HotplugMonitor&) = delete;
+
+    int fd() const {
+        return fd_;
+    }
+
+    // Read all pending events. Returns true if a tty was added, or
+    // if events were lost and one might have been.
+    bool ttyAdded();
+
+ private:
+    int fd_ = -1;
+};
+
+}
+
+#endif
@@ -0,0 +1,43 @@
+#include "Pty.h"
+
+#include <cerrno>
+#include <cstdlib>
+#include <system_error>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+
+namespace frugal {
+
+int openPty(std::string& name)
+{
+    int fd = posix_openpt(O_RDWR | O_NOCTTY | O_CLOEXEC);
+    if (fd < 0)
+        throw std::system_error(errno, std::generic_category(), "pseudo-terminal");
+    termios tio;
+    if (grantpt(fd) < 0 || unlockpt(fd) < 0 || tcgetattr(fd, &tio) < 0) {
+        int err = errno;
+        close(fd);
+        throw std::system_error(err, std::generic_category(), "pseudo-terminal");
+    }
+    cfmakeraw(&tio);
+    tcsetattr(fd, TCSANOW, &tio);
+    name = ptsname(fd);
+    return fd;
+}
+
+void waitForPtyPeer(int fd)
+{
+    // The master end hangs up while the other end is not open.
+    for (;;) {
+        pollfd pfd = { fd, POLLIN, 0 };
+        poll(&pfd, 1, 0);
+        if (!(pfd.revents & POLLHUP))
+            return;
+        usleep(10000);
+    }
+}
+
+}
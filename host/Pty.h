@@ -0,0 +1,21 @@
+#ifndef FRUGAL_PTY_H
+#define FRUGAL_PTY_H
+
+#include <string>
+
+namespace frugal {
+
+/*
+  Pseudo-terminals that stand in for the watchdog's serial port. The
+  master end is returned in raw mode, and name is set to the path of
+  the other end, which host tools open as if it were the device.
+  Throws std::system_error.
+*/
+int openPty(std::string& name);
+
+// Wait until the other end of the pseudo-terminal has been opened.
+void waitForPtyPeer(int fd);
+
+}
+
+#endif
@@ -0,0 +1,172 @@
+#include "SerialPort.h"
+
+#include <cerrno>
+#include <chrono>
+#include <system_error>
+#include <thread>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/file.h>
+#include <termios.h>
+#include <unistd.h>
+
+namespace frugal {
+
+using Clock = std::chrono::steady_clock;
+
+static speed_t baudToSpeed(unsigned baud)
+{
+    switch (baud) {
+    case 1200: return B1200;
+    case 2400: return B2400;
+    case 4800: return B4800;
+    case 9600: return B9600;
+    case 19200: return B19200;
+    case 38400: return B38400;
+    case 57600: return B57600;
+    case 115200: return B115200;
+    }
+    throw std::system_error(EINVAL, std::generic_category(),
+                            "unsupported baud rate");
+}
+
+static int remainingMs(Clock::time_point deadline)
+{
+    auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+        deadline - Clock::now()).count();
+    return left > 0 ? left : 0;
+}
+
+SerialPort::SerialPort(const std::string& path, unsigned baud, bool nonBlocking)
+{
+    open(path, baud, nonBlocking);
+}
+
+SerialPort::~SerialPort()
+{
+    close();
+}
+
+void SerialPort::open(const std::string& path, unsigned baud, bool nonBlocking)
+{
+    close();
+    int fd = ::open(path.c_str(), O_RDWR | O_NOCTTY | O_CLOEXEC | O_NONBLOCK);
+    if (fd < 0)
+        throw std::system_error(errno, std::generic_category(), path);
+
+    termios tio;
+    if (tcgetattr(fd, &tio) < 0) {
+        int err = errno;
+        ::close(fd);
+        throw std::system_error(err, std::generic_category(), path);
+    }
+    cfmakeraw(&tio);
+    tio.c_cflag |= CLOCAL | CREAD | HUPCL;
+    tio.c_cflag &= ~(CSTOPB | CRTSCTS);
+    tio.c_cc[VMIN] = 0;
+    tio.c_cc[VTIME] = 0;
+    speed_t speed = baudToSpeed(baud);
+    cfsetispeed(&tio, speed);
+    cfsetospeed(&tio, speed);
+    if (tcsetattr(fd, TCSANOW, &tio) < 0
+        || (!nonBlocking && fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK) < 0)) {
+        int err = errno;
+        ::close(fd);
+        throw std::system_error(err, std::generic_category(), path);
+    }
+
+    fd_ = fd;
+    path_ = path;
+    pending_.clear();
+}
+
+void SerialPort::close()
+{
+    if (fd_ >= 0)
+        ::close(fd_);
+    fd_ = -1;
+}
+
+bool SerialPort::lock(int timeoutMs)
+{
+    auto deadline = Clock::now() + std::chrono::milliseconds(timeoutMs);
+    for (;;) {
+        if (0 == flock(fd_, LOCK_EX | LOCK_NB))
+            return true;
+        if (errno != EWOULDBLOCK && errno != EINTR)
+            throw std::system_error(errno, std::generic_category(), path_);
+        if (Clock::now() >= deadline)
+            return false;
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+}
+
+void SerialPort::unlock()
+{
+    flock(fd_, LOCK_UN);
+}
+
+void SerialPort::write(const std::string& data)
+{
+    const char* p = data.data();
+    size_t left = data.size();
+    while (left) {
+        ssize_t n = ::write(fd_, p, left);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            throw std::system_error(errno, std::generic_category(), path_);
+        }
+        p += n;
+        left -= n;
+    }
+    tcdrain(fd_);
+}
+
+bool SerialPort::readLine(std::string& line, int timeoutMs)
+{
+    auto deadline = Clock::now() + std::chrono::milliseconds(timeoutMs);
+    for (;;) {
+        auto eol = pending_.find('\n');
+        if (eol != std::string::npos) {
+            line = pending_.substr(0, eol);
+            pending_.erase(0, eol + 1);
+            return true;
+        }
+
+        pollfd pfd = { fd_, POLLIN, 0 };
+        int r = poll(&pfd, 1, remainingMs(deadline));
+        if (r < 0) {
+            if (errno == EINTR)
+                continue;
+            throw std::system_error(errno, std::generic_category(), path_);
+        }
+        if (r == 0)
+            return false;
+
+        char buf[64];
+        ssize_t n = ::read(fd_, buf, sizeof(buf));
+        if (n < 0) {
+            if (errno == EINTR || errno == EAGAIN)
+                continue;
+            throw std::system_error(errno, std::generic_category(), path_);
+        }
+        if (n == 0) {
+            // The device has gone away.
+            throw std::system_error(EIO, std::generic_category(), path_);
+        }
+        for (ssize_t i = 0; i < n; ++i) {
+            if (buf[i] != '\r')
+                pending_ += buf[i];
+        }
+    }
+}
+
+void SerialPort::flushInput()
+{
+    tcflush(fd_, TCIFLUSH);
+    pending_.clear();
+}
+
+}
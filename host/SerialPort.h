@@ -0,0 +1,67 @@
+#ifndef FRUGAL_SERIAL_PORT_H
+#define FRUGAL_SERIAL_PORT_H
+
+#include <string>
+
+namespace frugal {
+
+/*
+  A serial port set up for talking to the watchdog: raw mode, 8N1, and
+  the given baud rate. The port is locked with flock() around each
+  exchange, the same way the frugal_watchdog script does it, so the
+  two can be used side by side.
+
+  Errors are reported by throwing std::system_error.
+*/
+class SerialPort
+{
+ public:
+    SerialPort() = default;
+    SerialPort(const std::string& path, unsigned baud, bool nonBlocking = false);
+    ~SerialPort();
+
+    SerialPort(const SerialPort&) = delete;
+    SerialPort& operator=(const SerialPort&) = delete;
+
+    // Open the port without waiting for the modem lines. If
+    // nonBlocking is set, the descriptor is left in non-blocking mode
+    // for use with poll(); write() and readLine() then must not be
+    // used.
+    void open(const std::string& path, unsigned baud, bool nonBlocking = false);
+    void close();
+    bool isOpen() const {
+        return fd_ >= 0;
+    }
+
+    int fd() const {
+        return fd_;
+    }
+
+    const std::string& path() const {
+        return path_;
+    }
+
+    // Take the exclusive lock, waiting at most timeoutMs. Returns
+    // false if the lock could not be taken in time.
+    bool lock(int timeoutMs);
+    void unlock();
+
+    // Write all of data and wait until it has been transmitted.
+    void write(const std::string& data);
+
+    // Read a line terminated by LF, waiting at most timeoutMs for
+    // it. CR characters are dropped. Returns false on timeout.
+    bool readLine(std::string& line, int timeoutMs);
+
+    // Discard any pending input.
+    void flushInput();
+
+ private:
+    int fd_ = -1;
+    std::string path_;
+    std::string pending_;
+};
+
+}
+
+#endif
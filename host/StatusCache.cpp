@@ -0,0 +1,111 @@
+#include "StatusCache.h"
+
+#include <cerrno>
+#include <cstring>
+#include <system_error>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace frugal {
+
+static const uint32_t magic = 0x46575331;  // "FWS1"
+static const size_t stateWords = sizeof(DeviceState) / 8;
+// An update takes a few dozen stores; a reader that still sees one in
+// progress after this many tries gives up.
+static const int readTries = 1000;
+
+struct Segment
+{
+    uint32_t magic;
+    std::atomic<uint32_t> sequence;
+    std::atomic<uint64_t> words[stateWords];
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free,
+              "The segment is shared between processes.");
+
+static void* mapSegment(const std::string& name, bool writable)
+{
+    int fd = shm_open(name.c_str(), writable ? O_RDWR | O_CREAT : O_RDONLY, 0644);
+    if (fd < 0)
+        throw std::system_error(errno, std::generic_category(), name);
+    // Others may read the state, whatever the umask.
+    if (writable && (fchmod(fd, 0644) < 0 || ftruncate(fd, sizeof(Segment)) < 0)) {
+        int err = errno;
+        close(fd);
+        throw std::system_error(err, std::generic_category(), name);
+    }
+    void* p = mmap(nullptr, sizeof(Segment), writable ? PROT_READ | PROT_WRITE : PROT_READ,
+                   MAP_SHARED, fd, 0);
+    int err = errno;
+    close(fd);
+    if (p == MAP_FAILED)
+        throw std::system_error(err, std::generic_category(), name);
+    return p;
+}
+
+StatusPublisher::StatusPublisher(const std::string& name)
+{
+    segment_ = (Segment*)mapSegment(name, true);
+    segment_->magic = magic;
+    // An update cut short by a crash leaves the counter odd.
+    uint32_t sequence = segment_->sequence.load(std::memory_order_relaxed);
+    if (sequence & 1)
+        segment_->sequence.store(sequence + 1, std::memory_order_release);
+}
+
+StatusPublisher::~StatusPublisher()
+{
+    munmap(segment_, sizeof(Segment));
+}
+
+void StatusPublisher::publish(const DeviceState& state)
+{
+    uint64_t words[stateWords];
+    memcpy(words, &state, sizeof(words));
+
+    uint32_t sequence = segment_->sequence.load(std::memory_order_relaxed);
+    segment_->sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    for (size_t i = 0; i < stateWords; ++i)
+        segment_->words[i].store(words[i], std::memory_order_relaxed);
+    segment_->sequence.store(sequence + 2, std::memory_order_release);
+}
+
+StatusReader::StatusReader(const std::string& name)
+{
+    segment_ = (const Segment*)mapSegment(name, false);
+}
+
+StatusReader::~StatusReader()
+{
+    munmap(const_cast<Segment*>(segment_), sizeof(Segment));
+}
+
+bool StatusReader::read(DeviceState& state) const
+{
+    uint64_t words[stateWords];
+    for (int i = 0; i < readTries; ++i) {
+        if (i)
+            std::this_thread::yield();
+        uint32_t before = segment_->sequence.load(std::memory_order_acquire);
+        if (before & 1)
+            continue;
+        for (size_t i = 0; i < stateWords; ++i)
+            words[i] = segment_->words[i].load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (segment_->sequence.load(std::memory_order_relaxed) != before)
+            continue;
+        if (segment_->magic != magic || before == 0)
+            return false;
+        memcpy(&state, words, sizeof(state));
+        return true;
+    }
+    return false;
+}
+
+}
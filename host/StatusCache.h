@@ -0,0 +1,89 @@
+#ifndef FRUGAL_STATUS_CACHE_H
+#define FRUGAL_STATUS_CACHE_H
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+namespace frugal {
+
+/*
+  The last known state of the watchdog, published in shared memory by
+  the program that owns the port, so that monitoring can read it
+  without touching the serial line or waiting for the port's lock.
+
+  There is one writer. It updates the state under a sequence lock:
+  the counter is odd while an update is in progress, and readers retry
+  if it was odd or changed while they copied the state. Readers never
+  block the writer, and a read costs a few dozen loads.
+
+  The writer also publishes how often it updates the state, so that
+  readers can tell when it has stopped, see isStale().
+
+  Errors are reported by throwing std::system_error.
+*/
+struct DeviceState
+{
+    uint64_t updatedNs;      // CLOCK_MONOTONIC when status was read.
+    uint64_t lastContactNs;  // CLOCK_MONOTONIC of the last good exchange.
+    uint64_t lastHeartbeat;  // Seconds since epoch, 0 if none was sent.
+    uint64_t lastTimeout;    // Stored by the device at its last timeout,
+                             // as seconds since epoch, 0 if none.
+    uint32_t elapsed;        // Seconds, when status was read.
+    uint32_t timeout;        // Seconds.
+    uint32_t failures;       // Failed exchanges in a row.
+    int32_t lastError;       // errno of the last failure.
+    uint8_t armed;           // The countdown runs, as far as the host knows.
+    uint8_t linkUp;          // The last exchange succeeded.
+    uint8_t reserved[2];
+    uint32_t intervalMs;     // How often the writer publishes, 0 if unknown.
+    uint64_t publishedNs;    // CLOCK_MONOTONIC of the last publication.
+};
+
+static_assert(sizeof(DeviceState) % 8 == 0, "The state is copied in words.");
+
+// Whether the writer has missed two of its publications, e.g. because
+// it died. The state then says nothing about the device any more.
+inline bool isStale(const DeviceState& state, uint64_t nowNs)
+{
+    return state.intervalMs && nowNs - state.publishedNs > state.intervalMs * 2000000ULL;
+}
+
+class StatusPublisher
+{
+ public:
+    // Create or take over the segment with the given name, e.g.
+    // "/frugal_watchdog", readable by everyone.
+    explicit StatusPublisher(const std::string& name);
+    ~StatusPublisher();
+
+    StatusPublisher(const StatusPublisher&) = delete;
+    StatusPublisher& operator=(const StatusPublisher&) = delete;
+
+    void publish(const DeviceState& state);
+
+ private:
+    struct Segment* segment_;
+};
+
+class StatusReader
+{
+ public:
+    explicit StatusReader(const std::string& name);
+    ~StatusReader();
+
+    StatusReader(const StatusReader&) = delete;
+    StatusReader& operator=(const StatusReader&) = delete;
+
+    // Copy the current state. Returns false if nothing has been
+    // published yet, or if no consistent copy could be made, which
+    // happens when a writer died in the middle of an update.
+    bool read(DeviceState& state) const;
+
+ private:
+    const struct Segment* segment_;
+};
+
+}
+
+#endif
@@ -0,0 +1,225 @@
+#include "Trace.h"
+
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <system_error>
+
+#include <fcntl.h>
+#include <libgen.h>
+#include <unistd.h>
+
+namespace frugal {
+
+static const char magic[8] = { 'F', 'W', 'T', 'R', 'A', 'C', 'E', 1 };
+static const size_t headerSize = 32;
+
+static uint64_t nowNs(clockid_t clock)
+{
+    timespec t;
+    clock_gettime(clock, &t);
+    return t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
+static void putLe(unsigned char* p, uint64_t value, int bytes)
+{
+    for (int i = 0; i < bytes; ++i)
+        p[i] = value >> (8 * i);
+}
+
+static uint64_t getLe(const unsigned char* p, int bytes)
+{
+    uint64_t value = 0;
+    for (int i = 0; i < bytes; ++i)
+        value |= (uint64_t)p[i] << (8 * i);
+    return value;
+}
+
+static size_t putVarint(unsigned char* p, uint64_t value)
+{
+    size_t n = 0;
+    do {
+        p[n] = (value & 0x7f) | (value > 0x7f ? 0x80 : 0);
+        value >>= 7;
+        ++n;
+    } while (value);
+    return n;
+}
+
+static bool getVarint(FILE* file, uint64_t& value)
+{
+    value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        int c = getc(file);
+        if (c == EOF)
+            return false;
+        value |= (uint64_t)(c & 0x7f) << shift;
+        if (!(c & 0x80))
+            return true;
+    }
+    return false;
+}
+
+TraceWriter::TraceWriter(const std::string& path, size_t maxBytes, unsigned baud)
+    : path_(path), maxBytes_(maxBytes), baud_(baud)
+{
+    start(nowNs(CLOCK_MONOTONIC) / 1000);
+    if (!file_)
+        throw std::system_error(errno, std::generic_category(), path);
+    thread_ = std::thread(&TraceWriter::run, this);
+}
+
+TraceWriter::~TraceWriter()
+{
+    {
+        std::lock_guard<std::mutex> guard(mutex_);
+        stop_ = true;
+    }
+    wakeup_.notify_one();
+    thread_.join();
+    if (file_)
+        fclose(file_);
+}
+
+// Starts a new file whose header is dated at us on the monotonic clock,
+// which may be a little in the past.
+void TraceWriter::start(uint64_t us)
+{
+    if (file_)
+        fclose(file_);
+    rename(path_.c_str(), (path_ + ".1").c_str());
+    file_ = fopen(path_.c_str(), "wbe");
+    if (!file_)
+        return;
+
+    unsigned char header[headerSize] = {};
+    memcpy(header, magic, sizeof(magic));
+    putLe(header + 8, baud_, 4);
+    uint64_t monotonic = us * 1000;
+    putLe(header + 16, nowNs(CLOCK_REALTIME) - (nowNs(CLOCK_MONOTONIC) - monotonic), 8);
+    putLe(header + 24, monotonic, 8);
+    lastUs_ = us;
+    size_ = fwrite(header, 1, sizeof(header), file_);
+
+    // Make the new name durable too, or a reset could lose the file.
+    std::string dir = path_;
+    int fd = ::open(dirname(&dir[0]), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd >= 0) {
+        fsync(fd);
+        close(fd);
+    }
+}
+
+void TraceWriter::record(Direction direction, const char* data, size_t size)
+{
+    uint64_t us = nowNs(CLOCK_MONOTONIC) / 1000;
+    {
+        std::lock_guard<std::mutex> guard(mutex_);
+        if (failed_ || pendingBytes_ + size > maxBytes_ / 2)
+            return;
+        pending_.push_back({ direction, us, std::string(data, size) });
+        pendingBytes_ += size;
+    }
+    wakeup_.notify_one();
+}
+
+void TraceWriter::flush()
+{
+    {
+        std::lock_guard<std::mutex> guard(mutex_);
+        sync_ = true;
+    }
+    wakeup_.notify_one();
+}
+
+void TraceWriter::write(const Pending& record)
+{
+    if (!file_)
+        return;
+    if (size_ >= maxBytes_ / 2) {
+        start(record.us);
+        if (!file_)
+            return;
+    }
+
+    unsigned char prefix[20];
+    size_t n = putVarint(prefix, record.us - lastUs_);
+    n += putVarint(prefix + n, (uint64_t)record.data.size() << 1 | (uint8_t)record.direction);
+    lastUs_ = record.us;
+    size_t size = record.data.size();
+    if (fwrite(prefix, 1, n, file_) != n || fwrite(record.data.data(), 1, size, file_) != size) {
+        fclose(file_);
+        file_ = nullptr;
+        return;
+    }
+    size_ += n + size;
+}
+
+// Writes out what was recorded, and syncs when asked to. Records that
+// come in during a sync are taken together in the next round.
+void TraceWriter::run()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (;;) {
+        wakeup_.wait(lock, [this] { return stop_ || sync_ || !pending_.empty(); });
+        std::deque<Pending> records;
+        records.swap(pending_);
+        pendingBytes_ = 0;
+        bool sync = sync_ || stop_;
+        bool stop = stop_;
+        sync_ = false;
+        lock.unlock();
+
+        for (auto& record : records)
+            write(record);
+        if (sync && file_ && fflush(file_) == 0)
+            fdatasync(fileno(file_));
+
+        lock.lock();
+        if (!file_)
+            failed_ = true;
+        if (stop && pending_.empty())
+            return;
+    }
+}
+
+TraceReader::TraceReader(const std::string& path)
+{
+    file_ = fopen(path.c_str(), "rbe");
+    if (!file_)
+        throw std::system_error(errno, std::generic_category(), path);
+    unsigned char header[headerSize];
+    if (fread(header, 1, sizeof(header), file_) != sizeof(header)
+        || memcmp(header, magic, sizeof(magic)) != 0) {
+        fclose(file_);
+        throw std::system_error(std::make_error_code(std::errc::bad_message), path);
+    }
+    baud_ = getLe(header + 8, 4);
+    startNs_ = getLe(header + 16, 8);
+    us_ = getLe(header + 24, 8) / 1000;
+}
+
+TraceReader::~TraceReader()
+{
+    fclose(file_);
+}
+
+bool TraceReader::next(Record& record)
+{
+    uint64_t delta, lengthAndDirection;
+    if (!getVarint(file_, delta) || !getVarint(file_, lengthAndDirection))
+        return false;
+    size_t size = lengthAndDirection >> 1;
+    // No single read or write comes near this.
+    if (size > 65536)
+        return false;
+    record.data.resize(size);
+    if (fread(&record.data[0], 1, size, file_) != size)
+        return false;
+    us_ += delta;
+    record.us = us_;
+    record.direction = (Direction)(lengthAndDirection & 1);
+    return true;
+}
+
+}
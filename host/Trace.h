@@ -0,0 +1,134 @@
+#ifndef FRUGAL_TRACE_H
+#define FRUGAL_TRACE_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace frugal {
+
+/*
+  Traces of the serial traffic, for finding out afterwards what the
+  device was told and when.
+
+  A trace file starts with a header: the magic "FWTRACE" and a version
+  byte, the baud rate as 32 bits, 32 reserved bits, and the wall clock
+  and monotonic clock at the start in nanoseconds, each 64 bits, all
+  little-endian. Records follow, each made of the microseconds since
+  the previous record (or the start) and the length shifted left by
+  one with the direction in the lowest bit, both as LEB128 varints,
+  and then the bytes themselves. A record costs three bytes on top of
+  its data in the common case.
+
+  To bound the disk usage, the writer starts a new file once the
+  current one reaches half the limit, and keeps the previous one with
+  ".1" appended to its name.
+
+  The records are written and synced to the disk by a thread of the
+  writer, so that a slow disk never holds up the traffic. Should the
+  disk fall behind by half the limit, further records are dropped
+  until it catches up.
+*/
+
+enum class Direction : uint8_t
+{
+    ToDevice = 0,
+    FromDevice = 1,
+};
+
+class TraceWriter
+{
+ public:
+    // An existing trace at path is kept as the previous file. Throws
+    // std::system_error.
+    TraceWriter(const std::string& path, size_t maxBytes, unsigned baud);
+    ~TraceWriter();
+
+    TraceWriter(const TraceWriter&) = delete;
+    TraceWriter& operator=(const TraceWriter&) = delete;
+
+    // Record data with the current time. Write errors stop the trace
+    // rather than the caller.
+    void record(Direction direction, const char* data, size_t size);
+    // Have the records so far written out to the disk with
+    // fdatasync(), without waiting for it. A watchdog reset is a hard
+    // one, and would lose whatever only made it to the page cache.
+    // Device calls it after each exchange.
+    void flush();
+
+ private:
+    struct Pending
+    {
+        Direction direction;
+        uint64_t us;
+        std::string data;
+    };
+
+    void start(uint64_t us);
+    void write(const Pending& record);
+    void run();
+
+    std::string path_;
+    size_t maxBytes_;
+    unsigned baud_;
+
+    // Only used by the thread, once it runs.
+    FILE* file_ = nullptr;
+    size_t size_ = 0;
+    uint64_t lastUs_ = 0;
+
+    std::mutex mutex_;
+    std::condition_variable wakeup_;
+    std::deque<Pending> pending_;
+    size_t pendingBytes_ = 0;
+    bool sync_ = false;
+    bool failed_ = false;
+    bool stop_ = false;
+    std::thread thread_;
+};
+
+class TraceReader
+{
+ public:
+    struct Record
+    {
+        Direction direction;
+        uint64_t us;  // On the monotonic clock of the recording host.
+        std::string data;
+    };
+
+    // Throws std::system_error, with bad_message if the file is not a
+    // trace.
+    explicit TraceReader(const std::string& path);
+    ~TraceReader();
+
+    TraceReader(const TraceReader&) = delete;
+    TraceReader& operator=(const TraceReader&) = delete;
+
+    unsigned baud() const {
+        return baud_;
+    }
+
+    // Wall clock time at the start of the file, in nanoseconds.
+    uint64_t startNs() const {
+        return startNs_;
+    }
+
+    // Read the next record. Returns false at the end of the file; a
+    // record cut short by a crash also ends it.
+    bool next(Record& record);
+
+ private:
+    FILE* file_ = nullptr;
+    unsigned baud_ = 0;
+    uint64_t startNs_ = 0;
+    uint64_t us_ = 0;
+};
+
+}
+
+#endif
@@ -0,0 +1,464 @@
+/*
+  Provides the watchdog as a standard Linux watchdog device, e.g.
+  /dev/watchdog, through CUSE (character devices in user space).
+
+  Programs that know the kernel's watchdog interface, such as
+  watchdog(8) or systemd, can then use FrugalWatchdog without a script:
+  opening the device starts the countdown, every write or
+  WDIOC_KEEPALIVE sends a heartbeat, and WDIOC_SETTIMEOUT and
+  WDIOC_GETTIMELEFT map to the timeout and status commands. Closing
+  the device stops the countdown only after the magic character 'V'
+  has been written, and never with -N.
+
+  The CUSE protocol is spoken directly over /dev/cuse, which needs
+  root. The port is held open by a Device, so requests never wait for
+  the port to be opened or configured, and they are answered from the
+  Device's thread when the watchdog replies.
+*/
+
+#include "Device.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include <fcntl.h>
+#include <linux/fuse.h>
+#include <linux/watchdog.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+using namespace frugal;
+
+static volatile sig_atomic_t stopRequested = 0;
+
+static void onSignal(int)
+{
+    stopRequested = 1;
+}
+
+static void usage(const char* argv0)
+{
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "Options:\n"
+            "  -d <device>  serial device or usb:<serial> (default /dev/ttyUSB0)\n"
+            "  -b <baud>    baud rate (default 2400)\n"
+            "  -n <name>    name of the device in /dev (default watchdog)\n"
+            "  -r <ms>      wait this long for a vanished device (default 2000)\n"
+            "  -N           never stop the countdown when the device is closed\n"
+            "  -v           report every request\n",
+            argv0);
+}
+
+// Requests are at most this large; writes to a watchdog are short.
+static const uint32_t maxWrite = 4096;
+
+class CuseWatchdog
+{
+ public:
+    CuseWatchdog(int fd, Device& device, const std::string& name, bool nowayout,
+                 bool verbose)
+        : fd_(fd), device_(device), name_(name), nowayout_(nowayout), verbose_(verbose)
+    {
+    }
+
+    // Handle one request read from /dev/cuse. Returns false if the
+    // kernel refused the device.
+    bool handle(const char* request, size_t size);
+
+ private:
+    void init(const fuse_in_header& in, const cuse_init_in& init);
+    void open(const fuse_in_header& in);
+    void write(const fuse_in_header& in, const fuse_write_in& write, const char* data,
+               size_t available);
+    void release(const fuse_in_header& in);
+    void ioctl(const fuse_in_header& in, const fuse_ioctl_in& ioctl, const char* data);
+
+    // Reply with an error, given as a positive errno, and the given
+    // data. Called from the Device's thread as well.
+    void reply(uint64_t unique, int error, const void* data = nullptr, size_t size = 0,
+               const void* more = nullptr, size_t moreSize = 0) const;
+    void replyIoctl(uint64_t unique, const void* data = nullptr, size_t size = 0) const;
+
+    static int errnoOf(std::error_code error);
+
+    int fd_;
+    Device& device_;
+    std::string name_;
+    bool nowayout_;
+    bool verbose_;
+    // Cleared by the Device's thread if the open fails.
+    std::atomic<bool> opened_{false};
+    bool expectClose_ = false;
+};
+
+int CuseWatchdog::errnoOf(std::error_code error)
+{
+    return error.category() == std::generic_category() ? error.value() : EIO;
+}
+
+void CuseWatchdog::reply(uint64_t unique, int error, const void* data, size_t size,
+                         const void* more, size_t moreSize) const
+{
+    fuse_out_header out = {};
+    out.len = sizeof(out) + size + moreSize;
+    out.error = -error;
+    out.unique = unique;
+    iovec iov[3] = {
+        { &out, sizeof(out) },
+        { const_cast<void*>(data), size },
+        { const_cast<void*>(more), moreSize },
+    };
+    // Fails only if the request was interrupted and is gone.
+    if (writev(fd_, iov, 3) < 0 && errno != ENOENT)
+        perror("cuse");
+}
+
+void CuseWatchdog::replyIoctl(uint64_t unique, const void* data, size_t size) const
+{
+    fuse_ioctl_out out = {};
+    reply(unique, 0, &out, sizeof(out), data, size);
+}
+
+bool CuseWatchdog::handle(const char* request, size_t size)
+{
+    if (size < sizeof(fuse_in_header))
+        return true;
+    const auto& in = *(const fuse_in_header*)request;
+    const char* body = request + sizeof(in);
+    size_t bodySize = size - sizeof(in);
+    if (verbose_)
+        fprintf(stderr, "request %u\n", in.opcode);
+
+    switch (in.opcode) {
+    case CUSE_INIT:
+        if (bodySize < sizeof(cuse_init_in)
+            || ((const cuse_init_in*)body)->major != FUSE_KERNEL_VERSION)
+            return false;
+        init(in, *(const cuse_init_in*)body);
+        return true;
+    case FUSE_OPEN:
+        open(in);
+        break;
+    case FUSE_WRITE:
+        if (bodySize < sizeof(fuse_write_in))
+            break;
+        write(in, *(const fuse_write_in*)body, body + sizeof(fuse_write_in),
+              bodySize - sizeof(fuse_write_in));
+        break;
+    case FUSE_FLUSH:
+        reply(in.unique, 0);
+        break;
+    case FUSE_RELEASE:
+        release(in);
+        break;
+    case FUSE_IOCTL:
+        if (bodySize < sizeof(fuse_ioctl_in))
+            break;
+        ioctl(in, *(const fuse_ioctl_in*)body, body + sizeof(fuse_ioctl_in));
+        break;
+    case FUSE_READ:
+        reply(in.unique, EINVAL);
+        break;
+    case FUSE_INTERRUPT:
+        // The heartbeat goes out anyway, and the reply is dropped.
+        break;
+    default:
+        reply(in.unique, ENOSYS);
+        break;
+    }
+    return true;
+}
+
+void CuseWatchdog::init(const fuse_in_header& in, const cuse_init_in& init)
+{
+    cuse_init_out out = {};
+    out.major = FUSE_KERNEL_VERSION;
+    out.minor = std::min<uint32_t>(init.minor, FUSE_KERNEL_MINOR_VERSION);
+    // The watchdog ioctls are not all encoded correctly: the argument
+    // of WDIOC_SETOPTIONS is marked as output only. Unrestricted
+    // ioctls let us ask for the data that we need.
+    out.flags = CUSE_UNRESTRICTED_IOCTL;
+    out.max_read = maxWrite;
+    out.max_write = maxWrite;
+    std::string info = "DEVNAME=" + name_;
+    reply(in.unique, 0, &out, sizeof(out), info.c_str(), info.size() + 1);
+}
+
+void CuseWatchdog::open(const fuse_in_header& in)
+{
+    // Like the kernel's watchdogs, the device can be opened once.
+    if (opened_) {
+        reply(in.unique, EBUSY);
+        return;
+    }
+    opened_ = true;
+    expectClose_ = false;
+    // Opening the device starts the countdown.
+    uint64_t unique = in.unique;
+    device_.reset([this, unique](std::error_code error) {
+        fuse_open_out out = {};
+        if (error) {
+            opened_ = false;
+            reply(unique, errnoOf(error));
+        } else {
+            reply(unique, 0, &out, sizeof(out));
+        }
+    });
+}
+
+void CuseWatchdog::write(const fuse_in_header& in, const fuse_write_in& write,
+                         const char* data, size_t available)
+{
+    uint32_t size = std::min<size_t>(write.size, available);
+    if (size == 0) {
+        fuse_write_out out = {};
+        reply(in.unique, 0, &out, sizeof(out));
+        return;
+    }
+    // Any write is a heartbeat. Closing may stop the countdown only if
+    // the last write contained the magic character.
+    expectClose_ = memchr(data, 'V', size) != nullptr;
+    uint64_t unique = in.unique;
+    device_.reset([this, unique, size](std::error_code error) {
+        fuse_write_out out = {};
+        out.size = size;
+        if (error)
+            reply(unique, errnoOf(error));
+        else
+            reply(unique, 0, &out, sizeof(out));
+    });
+}
+
+void CuseWatchdog::release(const fuse_in_header& in)
+{
+    opened_ = false;
+    uint64_t unique = in.unique;
+    if (!expectClose_ || nowayout_) {
+        fprintf(stderr, "%s closed unexpectedly, the countdown keeps running\n",
+                name_.c_str());
+        reply(unique, 0);
+        return;
+    }
+    expectClose_ = false;
+    device_.send(Opcode::stop, "", [this, unique](std::error_code error, const Device::Lines&) {
+        if (error)
+            fprintf(stderr, "Stopping the countdown failed: %s\n", error.message().c_str());
+        reply(unique, 0);
+    });
+}
+
+void CuseWatchdog::ioctl(const fuse_in_header& in, const fuse_ioctl_in& ioctl,
+                         const char* data)
+{
+    uint64_t unique = in.unique;
+    size_t inSize = 0;
+    size_t outSize = 0;
+    switch (ioctl.cmd) {
+    case WDIOC_GETSUPPORT:
+        outSize = sizeof(watchdog_info);
+        break;
+    case WDIOC_GETSTATUS:
+    case WDIOC_GETBOOTSTATUS:
+    case WDIOC_GETTIMEOUT:
+    case WDIOC_GETTIMELEFT:
+        outSize = sizeof(int);
+        break;
+    case WDIOC_SETOPTIONS:
+        inSize = sizeof(int);
+        break;
+    case WDIOC_SETTIMEOUT:
+        inSize = outSize = sizeof(int);
+        break;
+    case WDIOC_KEEPALIVE:
+        break;
+    default:
+        reply(unique, ENOTTY);
+        return;
+    }
+
+    // An unrestricted ioctl first comes without data. Tell the kernel
+    // where the argument is, and it sends the request again.
+    if (ioctl.in_size < inSize || ioctl.out_size < outSize) {
+        fuse_ioctl_out out = {};
+        out.flags = FUSE_IOCTL_RETRY;
+        fuse_ioctl_iovec iov[2];
+        uint32_t n = 0;
+        if (inSize) {
+            iov[n++] = { ioctl.arg, inSize };
+            out.in_iovs = 1;
+        }
+        if (outSize) {
+            iov[n++] = { ioctl.arg, outSize };
+            out.out_iovs = 1;
+        }
+        reply(unique, 0, &out, sizeof(out), iov, n * sizeof(iov[0]));
+        return;
+    }
+
+    int value = 0;
+    if (inSize)
+        memcpy(&value, data, sizeof(value));
+    switch (ioctl.cmd) {
+    case WDIOC_GETSUPPORT: {
+        watchdog_info info = {};
+        info.options = WDIOF_SETTIMEOUT | WDIOF_MAGICCLOSE | WDIOF_KEEPALIVEPING;
+        snprintf((char*)info.identity, sizeof(info.identity), "FrugalWatchdog");
+        replyIoctl(unique, &info, sizeof(info));
+        break;
+    }
+    case WDIOC_GETSTATUS:
+    case WDIOC_GETBOOTSTATUS:
+        replyIoctl(unique, &value, sizeof(value));
+        break;
+    case WDIOC_GETTIMEOUT:
+    case WDIOC_GETTIMELEFT: {
+        bool left = ioctl.cmd == WDIOC_GETTIMELEFT;
+        device_.status([this, unique, left](std::error_code error, const StatusReply& status) {
+            if (error) {
+                reply(unique, errnoOf(error));
+                return;
+            }
+            int seconds = !left ? status.timeout
+                : status.elapsed < status.timeout ? status.timeout - status.elapsed : 0;
+            replyIoctl(unique, &seconds, sizeof(seconds));
+        });
+        break;
+    }
+    case WDIOC_SETOPTIONS:
+        if (value & WDIOS_DISABLECARD) {
+            device_.send(Opcode::stop, "", [this, unique](std::error_code error,
+                                                          const Device::Lines&) {
+                if (error)
+                    reply(unique, errnoOf(error));
+                else
+                    replyIoctl(unique);
+            });
+        } else if (value & WDIOS_ENABLECARD) {
+            device_.reset([this, unique](std::error_code error) {
+                if (error)
+                    reply(unique, errnoOf(error));
+                else
+                    replyIoctl(unique);
+            });
+        } else {
+            reply(unique, EINVAL);
+        }
+        break;
+    case WDIOC_SETTIMEOUT:
+        if (value <= 0) {
+            reply(unique, EINVAL);
+            break;
+        }
+        // As with the kernel's watchdogs, a new timeout comes with a
+        // heartbeat. The commands are sent in order.
+        device_.setTimeout(value, [](std::error_code error) {
+            if (error)
+                fprintf(stderr, "Setting the timeout failed: %s\n", error.message().c_str());
+        });
+        device_.reset([this, unique, value](std::error_code error) {
+            if (error)
+                reply(unique, errnoOf(error));
+            else
+                replyIoctl(unique, &value, sizeof(value));
+        });
+        break;
+    case WDIOC_KEEPALIVE:
+        device_.reset([this, unique](std::error_code error) {
+            if (error)
+                reply(unique, errnoOf(error));
+            else
+                replyIoctl(unique);
+        });
+        break;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    std::string device = "/dev/ttyUSB0";
+    unsigned baud = 2400;
+    std::string name = "watchdog";
+    Milliseconds reconnectWait(2000);
+    bool nowayout = false;
+    bool verbose = false;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "d:b:n:r:Nvh")) != -1) {
+        switch (opt) {
+        case 'd': device = optarg; break;
+        case 'b': baud = atoi(optarg); break;
+        case 'n': name = optarg; break;
+        case 'r': reconnectWait = Milliseconds(atoi(optarg)); break;
+        case 'N': nowayout = true; break;
+        case 'v': verbose = true; break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (optind != argc) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    Device watchdog;
+    watchdog.reconnectWait = reconnectWait;
+    try {
+        watchdog.open(device, baud);
+    } catch (std::system_error& e) {
+        fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+
+    int fd = ::open("/dev/cuse", O_RDWR | O_CLOEXEC);
+    if (fd < 0) {
+        perror("/dev/cuse");
+        return 1;
+    }
+
+    // Without SA_RESTART, a signal interrupts the read.
+    struct sigaction sa = {};
+    sa.sa_handler = onSignal;
+    sigaction(SIGINT, &sa, nullptr);
+    sigaction(SIGTERM, &sa, nullptr);
+
+    CuseWatchdog cuse(fd, watchdog, name, nowayout, verbose);
+    std::vector<char> request(sizeof(fuse_in_header) + sizeof(fuse_write_in) + maxWrite
+                              + FUSE_MIN_READ_BUFFER);
+    while (!stopRequested) {
+        ssize_t n = read(fd, request.data(), request.size());
+        if (n < 0) {
+            // ENOENT: a request was interrupted before we read it.
+            if (errno == EINTR || errno == ENOENT || errno == EAGAIN)
+                continue;
+            // ENODEV: the kernel refused the device or it went away.
+            perror("/dev/cuse");
+            break;
+        }
+        // The device needs a working port, which the Device drops if
+        // it goes away for good.
+        if (!watchdog.isOpen()) {
+            try {
+                watchdog.open(device, baud);
+            } catch (std::system_error& e) {
+                fprintf(stderr, "%s\n", e.what());
+            }
+        }
+        if (!cuse.handle(request.data(), n)) {
+            fprintf(stderr, "Unexpected CUSE protocol\n");
+            break;
+        }
+    }
+    // The pending replies need the Device and the file descriptor.
+    watchdog.close();
+    close(fd);
+    return 0;
+}
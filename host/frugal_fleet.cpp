@@ -0,0 +1,455 @@
+/*
+  A fleet of virtual watchdogs for testing host tools at scale.
+
+  Runs any number of emulated devices, each on a pseudo-terminal of
+  its own, linked as <dir>/frugal<i>. Bytes travel at the rate of the
+  serial line in both directions, so replies take as long as they
+  would from the firmware. Faults can be injected: dropped bytes,
+  replies that come late, and ttys that vanish for a while and come
+  back under a new name. The fleet can grow as it runs, and every
+  report gives the host's load and the heartbeat figures for the
+  current size.
+*/
+
+#include "DeviceEmulator.h"
+#include "Pty.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <memory>
+#include <random>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace frugal;
+
+static volatile sig_atomic_t stopRequested = 0;
+
+static void onSignal(int)
+{
+    stopRequested = 1;
+}
+
+static void usage(const char* argv0)
+{
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "Options:\n"
+            "  -n <count>     devices at the start (default 10)\n"
+            "  -N <count>     grow the fleet up to this many devices\n"
+            "  -g <count>     devices added after every report (default 10)\n"
+            "  -r <seconds>   report interval (default 10)\n"
+            "  -i <ms>        expected heartbeat interval (default 10000)\n"
+            "  -b <baud>      baud rate of the emulated line (default 2400)\n"
+            "  -l <dir>       directory for the device links (default /tmp/frugal_fleet)\n"
+            "  -f <fault>     inject a fault, may be repeated:\n"
+            "                   drop:<per-mille>          bytes lost in either direction\n"
+            "                   slow:<per-mille>:<ms>     replies delayed this long\n"
+            "                   vanish:<seconds>:<ms>     a tty vanishes about once in this\n"
+            "                                             many seconds, for this long\n"
+            "  -s <seed>      seed for the faults (default 1)\n",
+            argv0);
+}
+
+static uint64_t monotonicUs()
+{
+    timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000ULL + t.tv_nsec / 1000;
+}
+
+static double percentile(std::vector<double> v, double p)
+{
+    if (v.empty())
+        return 0;
+    std::sort(v.begin(), v.end());
+    size_t i = std::min(v.size() - 1, (size_t)(p / 100 * v.size()));
+    return v[i];
+}
+
+struct Faults
+{
+    int dropPerMille = 0;
+    int slowPerMille = 0;
+    uint64_t slowUs = 0;
+    double vanishSeconds = 0;
+    uint64_t vanishUs = 0;
+};
+
+struct Endpoint
+{
+    int fd = -1;
+    int peer = -1;  // Keeps the tty from hanging up between users.
+    std::string link;
+    DeviceEmulator device;
+    std::string input;   // Received, still on the wire to the device.
+    uint64_t inputNext = 0;
+    std::string output;  // Replies, still on the wire to the host.
+    uint64_t outputNext = 0;
+    uint64_t downUntil = 0;
+    unsigned long heartbeats = 0;
+    uint64_t lastHeartbeat = 0;
+    unsigned long timeouts = 0;
+};
+
+// Busy and total jiffies of the whole host.
+static void hostCpu(unsigned long long& busy, unsigned long long& total)
+{
+    std::ifstream stat("/proc/stat");
+    std::string cpu;
+    unsigned long long user, nice, system, idle, iowait, irq, softirq;
+    busy = total = 0;
+    if (stat >> cpu >> user >> nice >> system >> idle >> iowait >> irq >> softirq) {
+        busy = user + nice + system + irq + softirq;
+        total = busy + idle + iowait;
+    }
+}
+
+static long memAvailableMiB()
+{
+    std::ifstream meminfo("/proc/meminfo");
+    std::string key;
+    long kib;
+    while (meminfo >> key >> kib) {
+        if (key == "MemAvailable:")
+            return kib / 1024;
+        meminfo.ignore(256, '\n');
+    }
+    return -1;
+}
+
+static long ownRssMiB()
+{
+    std::ifstream statm("/proc/self/statm");
+    long size, resident;
+    if (!(statm >> size >> resident))
+        return -1;
+    return resident * sysconf(_SC_PAGESIZE) / (1 << 20);
+}
+
+class Fleet
+{
+ public:
+    Fleet(const std::string& dir, unsigned baud, const Faults& faults, unsigned seed)
+        : dir_(dir), byteUs_(10000000ULL / baud), faults_(faults), random_(seed)
+    {
+        epoll_ = epoll_create1(EPOLL_CLOEXEC);
+        if (epoll_ < 0)
+            throw std::system_error(errno, std::generic_category(), "epoll");
+    }
+
+    void grow(size_t count)
+    {
+        while (endpoints_.size() < count) {
+            auto endpoint = std::make_unique<Endpoint>();
+            endpoint->link = dir_ + "/frugal" + std::to_string(endpoints_.size());
+            endpoints_.push_back(std::move(endpoint));
+            attach(endpoints_.size() - 1);
+        }
+    }
+
+    size_t size() const {
+        return endpoints_.size();
+    }
+
+    // Move the bytes that are due and handle the faults, then wait for
+    // input, for at most a millisecond while bytes are on the wire.
+    void step()
+    {
+        uint64_t now = monotonicUs();
+        for (size_t i : active_)
+            pump(i, now);
+        active_.erase(std::remove_if(active_.begin(), active_.end(), [this](size_t i) {
+                    return endpoints_[i]->input.empty() && endpoints_[i]->output.empty();
+                }), active_.end());
+
+        if (now >= nextCheck_) {
+            nextCheck_ = now + 100000;
+            check(now);
+        }
+
+        epoll_event events[64];
+        int timeout = active_.empty() ? (nextCheck_ - now + 999) / 1000 : 1;
+        int n = epoll_wait(epoll_, events, 64, timeout);
+        for (int k = 0; k < n; ++k)
+            receive(events[k].data.u64, events[k].events);
+    }
+
+    // Heartbeat gaps since the last call, in ms.
+    std::vector<double> takeGaps() {
+        std::vector<double> gaps;
+        gaps.swap(gaps_);
+        return gaps;
+    }
+
+    unsigned long takeTimeouts() {
+        unsigned long t = timeouts_;
+        timeouts_ = 0;
+        return t;
+    }
+
+    unsigned long takeVanished() {
+        unsigned long v = vanished_;
+        vanished_ = 0;
+        return v;
+    }
+
+ private:
+    bool chance(int perMille) {
+        return perMille && std::uniform_int_distribution<int>(0, 999)(random_) < perMille;
+    }
+
+    // Give the endpoint a new pseudo-terminal and point its link at it.
+    void attach(size_t i)
+    {
+        Endpoint& e = *endpoints_[i];
+        std::string name;
+        e.fd = openPty(name);
+        e.peer = open(name.c_str(), O_RDWR | O_NOCTTY | O_CLOEXEC);
+        std::string temporary = e.link + ".new";
+        unlink(temporary.c_str());
+        if (symlink(name.c_str(), temporary.c_str()) < 0
+            || rename(temporary.c_str(), e.link.c_str()) < 0)
+            perror(e.link.c_str());
+        epoll_event event = {};
+        event.events = EPOLLIN;
+        event.data.u64 = i;
+        epoll_ctl(epoll_, EPOLL_CTL_ADD, e.fd, &event);
+        e.input.clear();
+        e.output.clear();
+    }
+
+    void detach(size_t i, uint64_t now)
+    {
+        Endpoint& e = *endpoints_[i];
+        close(e.fd);
+        close(e.peer);
+        e.fd = e.peer = -1;
+        // Whatever was on the line is lost, and the endpoint leaves
+        // active_, so that step() sleeps again.
+        e.input.clear();
+        e.output.clear();
+        unlink(e.link.c_str());
+        e.downUntil = now + faults_.vanishUs;
+        ++vanished_;
+    }
+
+    void receive(size_t i, uint32_t events)
+    {
+        Endpoint& e = *endpoints_[i];
+        if (e.fd < 0 || !(events & EPOLLIN))
+            return;
+        char buf[256];
+        ssize_t n = read(e.fd, buf, sizeof(buf));
+        if (n <= 0)
+            return;
+        uint64_t now = monotonicUs();
+        if (e.input.empty() && e.output.empty())
+            active_.push_back(i);
+        if (e.input.empty())
+            e.inputNext = std::max(e.inputNext, now);
+        e.input.append(buf, n);
+    }
+
+    void pump(size_t i, uint64_t now)
+    {
+        Endpoint& e = *endpoints_[i];
+        if (e.fd < 0)
+            return;
+        // Bytes reach the device one at a time, at the rate of the
+        // line.
+        std::string reply;
+        size_t consumed = 0;
+        while (consumed < e.input.size() && e.inputNext <= now) {
+            if (!chance(faults_.dropPerMille))
+                e.device.input(&e.input[consumed], 1, e.inputNext, reply);
+            e.inputNext += byteUs_;
+            ++consumed;
+        }
+        e.input.erase(0, consumed);
+        if (e.device.heartbeats() != e.heartbeats) {
+            e.heartbeats = e.device.heartbeats();
+            if (e.lastHeartbeat)
+                gaps_.push_back((e.device.lastHeartbeat() - e.lastHeartbeat) / 1000.0);
+            e.lastHeartbeat = e.device.lastHeartbeat();
+        }
+        if (!reply.empty()) {
+            uint64_t start = now + (chance(faults_.slowPerMille) ? faults_.slowUs : 0);
+            if (e.output.empty())
+                e.outputNext = std::max(e.outputNext, start);
+            for (char c : reply) {
+                if (!chance(faults_.dropPerMille))
+                    e.output += c;
+            }
+        }
+
+        size_t due = 0;
+        while (due < e.output.size() && e.outputNext <= now) {
+            e.outputNext += byteUs_;
+            ++due;
+        }
+        if (due) {
+            ssize_t n = write(e.fd, e.output.data(), due);
+            e.output.erase(0, n > 0 ? n : due);
+        }
+    }
+
+    // Expire the countdowns, and let ttys vanish and come back. The
+    // device also expires on input, so its own count is what tells
+    // how many timeouts there were.
+    void check(uint64_t now)
+    {
+        double vanishChance = faults_.vanishSeconds > 0 ? 0.1 / faults_.vanishSeconds : 0;
+        std::uniform_real_distribution<double> uniform(0, 1);
+        for (size_t i = 0; i < endpoints_.size(); ++i) {
+            Endpoint& e = *endpoints_[i];
+            e.device.expire(now);
+            timeouts_ += e.device.timeouts() - e.timeouts;
+            e.timeouts = e.device.timeouts();
+            if (e.fd < 0) {
+                if (now >= e.downUntil)
+                    attach(i);
+                continue;
+            }
+            if (vanishChance && uniform(random_) < vanishChance)
+                detach(i, now);
+        }
+    }
+
+    std::string dir_;
+    uint64_t byteUs_;
+    Faults faults_;
+    std::mt19937 random_;
+    int epoll_;
+    std::vector<std::unique_ptr<Endpoint>> endpoints_;
+    std::vector<size_t> active_;
+    uint64_t nextCheck_ = 0;
+    std::vector<double> gaps_;
+    unsigned long timeouts_ = 0;
+    unsigned long vanished_ = 0;
+};
+
+int main(int argc, char** argv)
+{
+    size_t count = 10;
+    size_t maxCount = 0;
+    size_t growth = 10;
+    long reportInterval = 10;
+    double interval = 10000;
+    unsigned baud = 2400;
+    std::string dir = "/tmp/frugal_fleet";
+    Faults faults;
+    unsigned seed = 1;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "n:N:g:r:i:b:l:f:s:h")) != -1) {
+        switch (opt) {
+        case 'n': count = atol(optarg); break;
+        case 'N': maxCount = atol(optarg); break;
+        case 'g': growth = atol(optarg); break;
+        case 'r': reportInterval = atol(optarg); break;
+        case 'i': interval = atof(optarg); break;
+        case 'b': baud = atoi(optarg); break;
+        case 'l': dir = optarg; break;
+        case 'f': {
+            int a = 0, b = 0;
+            if (sscanf(optarg, "drop:%d", &a) == 1) {
+                faults.dropPerMille = a;
+            } else if (sscanf(optarg, "slow:%d:%d", &a, &b) == 2) {
+                faults.slowPerMille = a;
+                faults.slowUs = b * 1000ULL;
+            } else if (sscanf(optarg, "vanish:%d:%d", &a, &b) == 2) {
+                faults.vanishSeconds = a;
+                faults.vanishUs = b * 1000ULL;
+            } else {
+                fprintf(stderr, "Unknown fault '%s'.\n", optarg);
+                return 1;
+            }
+            break;
+        }
+        case 's': seed = atoi(optarg); break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (!count || !baud || reportInterval <= 0) {
+        usage(argv[0]);
+        return 1;
+    }
+    maxCount = std::max(maxCount, count);
+
+    // Every device needs a descriptor.
+    rlimit files;
+    getrlimit(RLIMIT_NOFILE, &files);
+    files.rlim_cur = files.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &files);
+    mkdir(dir.c_str(), 0755);
+
+    struct sigaction sa = {};
+    sa.sa_handler = onSignal;
+    sigaction(SIGINT, &sa, nullptr);
+    sigaction(SIGTERM, &sa, nullptr);
+
+    printf("%6s %8s %9s %9s %9s %8s %8s %7s %7s %8s %8s\n", "devs", "beats/s",
+           "late p50", "late p99", "late max", "timeouts", "vanished",
+           "cpu %", "own %", "own MiB", "free MiB");
+    fflush(stdout);
+    try {
+        Fleet fleet(dir, baud, faults, seed);
+        fleet.grow(count);
+        unsigned long long busy, total;
+        hostCpu(busy, total);
+        rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        double ownCpu = usage.ru_utime.tv_sec + usage.ru_stime.tv_sec
+            + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+        uint64_t reportAt = monotonicUs() + reportInterval * 1000000ULL;
+        while (!stopRequested) {
+            fleet.step();
+            uint64_t now = monotonicUs();
+            if (now < reportAt)
+                continue;
+
+            double seconds = reportInterval + (now - reportAt) / 1e6;
+            reportAt = now + reportInterval * 1000000ULL;
+            unsigned long long busyNow, totalNow;
+            hostCpu(busyNow, totalNow);
+            getrusage(RUSAGE_SELF, &usage);
+            double ownNow = usage.ru_utime.tv_sec + usage.ru_stime.tv_sec
+                + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+            std::vector<double> late = fleet.takeGaps();
+            size_t beats = late.size();
+            for (auto& gap : late)
+                gap = std::max(0.0, gap - interval);
+            printf("%6zu %8.1f %9.1f %9.1f %9.1f %8lu %8lu %7.1f %7.1f %8ld %8ld\n",
+                   fleet.size(), beats / seconds, percentile(late, 50),
+                   percentile(late, 99), percentile(late, 100), fleet.takeTimeouts(),
+                   fleet.takeVanished(),
+                   totalNow > total ? 100.0 * (busyNow - busy) / (totalNow - total) : 0,
+                   100 * (ownNow - ownCpu) / seconds, ownRssMiB(), memAvailableMiB());
+            fflush(stdout);
+            busy = busyNow;
+            total = totalNow;
+            ownCpu = ownNow;
+            if (fleet.size() < maxCount)
+                fleet.grow(std::min(maxCount, fleet.size() + growth));
+        }
+    } catch (std::system_error& e) {
+        fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+    return 0;
+}
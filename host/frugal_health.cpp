@@ -0,0 +1,233 @@
+/*
+  Health-checking heartbeat daemon for FrugalWatchdog.
+
+  Runs the given health checks concurrently in every interval and
+  sends a heartbeat to the watchdog only if all of them pass within
+  the budget. Unlike running frugal_watchdog from watchdog(8), nothing
+  is forked, and a check that hangs cannot hold back the heartbeat for
+  longer than the budget.
+*/
+
+#include "Device.h"
+#include "HealthCheck.h"
+#include "StatusCache.h"
+
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+
+#include <unistd.h>
+
+using namespace frugal;
+
+static volatile sig_atomic_t stopRequested = 0;
+
+static void onSignal(int)
+{
+    stopRequested = 1;
+}
+
+static void usage(const char* argv0)
+{
+    fprintf(stderr,
+            "Usage: %s [options] check...\n"
+            "Options:\n"
+            "  -d <device>   serial device or usb:<serial> (default /dev/ttyUSB0)\n"
+            "  -b <baud>     baud rate (default 2400)\n"
+            "  -i <seconds>  heartbeat interval (default 10)\n"
+            "  -B <ms>       time budget for all checks (default 2000)\n"
+            "  -D <ms>       default deadline of a check (default 1000)\n"
+            "  -t <seconds>  set the watchdog timeout on startup\n"
+            "  -r <ms>       wait this long for a vanished device (default 2000)\n"
+            "  -T <file>     record the serial traffic to file\n"
+            "  -S <KiB>      disk space for the traffic records (default 1024)\n"
+            "  -s <name>     publish the device state in this shared memory\n"
+            "                segment for frugal_status, e.g. /frugal_watchdog\n"
+            "  -v            report every round\n"
+            "Checks:\n"
+            "  load:<max>              1-minute load average at most max\n"
+            "  mem:<MiB>               at least this much memory available\n"
+            "  file:<path>:<seconds>   path modified at most this long ago\n"
+            "  proc:<name>             a process with this name is running\n"
+            "  tcp:<host>:<port>       a TCP connection can be made\n"
+            "Append @<ms> to a check to give it its own deadline.\n",
+            argv0);
+}
+
+// The device's clock is set and given a reference for calibration
+// every few minutes. The device only uses references that are at least
+// five minutes apart, so leave some room for jitter.
+static const time_t clockReferenceInterval = 330;
+
+// The reference clock for calibration. It must keep counting while
+// the host is suspended, as the device does, and it is the clock of
+// /proc/uptime, which frugal_watchdog uses.
+static unsigned long boottimeMs()
+{
+    timespec t;
+    clock_gettime(CLOCK_BOOTTIME, &t);
+    return t.tv_sec * 1000UL + t.tv_nsec / 1000000;
+}
+
+static uint64_t monotonicNs()
+{
+    timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
+static void sleepUntil(const timespec& t)
+{
+    while (!stopRequested
+           && EINTR == clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t, nullptr));
+}
+
+int main(int argc, char** argv)
+{
+    std::string device = "/dev/ttyUSB0";
+    unsigned baud = 2400;
+    unsigned interval = 10;
+    Milliseconds budget(2000);
+    Milliseconds defaultDeadline(1000);
+    unsigned timeout = 0;
+    Milliseconds reconnectWait(2000);
+    std::string tracePath;
+    size_t traceLimit = 1 << 20;
+    std::string statusName;
+    bool verbose = false;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "d:b:i:B:D:t:r:T:S:s:vh")) != -1) {
+        switch (opt) {
+        case 'd': device = optarg; break;
+        case 'b': baud = atoi(optarg); break;
+        case 'i': interval = atoi(optarg); break;
+        case 'B': budget = Milliseconds(atoi(optarg)); break;
+        case 'D': defaultDeadline = Milliseconds(atoi(optarg)); break;
+        case 't': timeout = atoi(optarg); break;
+        case 'r': reconnectWait = Milliseconds(atoi(optarg)); break;
+        case 'T': tracePath = optarg; break;
+        case 'S': traceLimit = atoi(optarg) * 1024UL; break;
+        case 's': statusName = optarg; break;
+        case 'v': verbose = true; break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (optind == argc || interval == 0) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (budget >= std::chrono::seconds(interval)) {
+        fprintf(stderr, "The budget must be shorter than the interval.\n");
+        return 1;
+    }
+    // The heartbeat is sent at most one budget late, and it must
+    // still arrive before the timeout.
+    if (timeout && std::chrono::seconds(interval) + budget >= std::chrono::seconds(timeout)) {
+        fprintf(stderr, "The interval plus budget must be shorter than the timeout.\n");
+        return 1;
+    }
+
+    std::vector<std::unique_ptr<HealthCheck>> checks;
+    try {
+        for (int i = optind; i < argc; ++i)
+            checks.push_back(HealthCheck::parse(argv[i], defaultDeadline));
+    } catch (std::invalid_argument& e) {
+        fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+    HealthEngine engine(std::move(checks));
+
+    std::unique_ptr<StatusPublisher> publisher;
+    DeviceState state = {};
+    state.intervalMs = interval * 1000;
+    if (!statusName.empty()) {
+        try {
+            publisher.reset(new StatusPublisher(statusName));
+        } catch (std::system_error& e) {
+            fprintf(stderr, "%s\n", e.what());
+            return 1;
+        }
+    }
+
+    struct sigaction sa = {};
+    sa.sa_handler = onSignal;
+    sigaction(SIGINT, &sa, nullptr);
+    sigaction(SIGTERM, &sa, nullptr);
+
+    Device watchdog;
+    watchdog.reconnectWait = reconnectWait;
+    watchdog.tracePath = tracePath;
+    watchdog.traceLimit = traceLimit;
+    bool timeoutSent = false;
+    time_t lastReference = 0;
+    timespec next;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    std::vector<std::string> failures;
+    while (!stopRequested) {
+        bool healthy = engine.runRound(budget, failures);
+        for (auto& failure : failures)
+            fprintf(stderr, "%s\n", failure.c_str());
+
+        try {
+            if (!watchdog.isOpen())
+                watchdog.open(device, baud);
+            if (timeout && !timeoutSent) {
+                watchdog.setTimeout(timeout).get();
+                timeoutSent = true;
+            }
+            if (!lastReference || next.tv_sec - lastReference >= clockReferenceInterval) {
+                // Only the low 32 bits matter to the device.
+                unsigned long reference = boottimeMs() & 0xffffffffUL;
+                watchdog.send(Opcode::clock, std::to_string(reference)).get();
+                watchdog.send(Opcode::epoch, std::to_string(time(nullptr))).get();
+                lastReference = next.tv_sec;
+            }
+            if (healthy) {
+                // The device timestamps a reset with its own clock.
+                watchdog.reset().get();
+                state.lastHeartbeat = time(nullptr);
+                state.armed = 1;
+                if (verbose)
+                    fprintf(stderr, "heartbeat sent\n");
+            } else {
+                fprintf(stderr, "unhealthy, heartbeat withheld\n");
+            }
+            if (publisher) {
+                // One status query per round, however often the state
+                // is read.
+                StatusReply status = watchdog.status().get();
+                state.updatedNs = state.lastContactNs = monotonicNs();
+                state.elapsed = status.elapsed;
+                state.timeout = status.timeout;
+                state.lastTimeout = strtoull(status.timestamp.c_str(), nullptr, 10);
+                // The countdown stops when it runs out.
+                if (status.elapsed >= status.timeout)
+                    state.armed = 0;
+                state.failures = 0;
+                state.linkUp = 1;
+            }
+        } catch (std::system_error& e) {
+            fprintf(stderr, "%s\n", e.what());
+            watchdog.close();
+            ++state.failures;
+            state.lastError = e.code().value();
+            state.linkUp = 0;
+        }
+        if (publisher) {
+            state.publishedNs = monotonicNs();
+            publisher->publish(state);
+        }
+
+        next.tv_sec += interval;
+        sleepUntil(next);
+    }
+    return 0;
+}
@@ -0,0 +1,301 @@
+/*
+  Heartbeat daemon for FrugalWatchdog that keeps its timing when the
+  host is under memory or CPU pressure.
+
+  Everything is prepared at startup: the commands are encoded, the
+  memory is locked with mlockall() and the stack is touched, so that
+  the steady state neither allocates, forks nor pages. Heartbeats are
+  driven by an absolute timerfd, optionally at a real-time priority,
+  and each one is measured against its schedule. The lateness is kept
+  in a histogram that is printed on SIGUSR1 and at exit.
+*/
+
+#include "Commands.h"
+#include "Hotplug.h"
+#include "SerialPort.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <system_error>
+
+#include <poll.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+using namespace frugal;
+
+// Lateness buckets: below 1 ms, below 2 ms, ... below 2^(n-2) ms, and
+// the rest.
+static const int latenessBuckets = 18;
+// How long the device is given to handle a heartbeat before the port
+// is unlocked, as the frugal_watchdog script does.
+static const long commandGapNs = 100000000;
+// How long to wait for the port to be unlocked.
+static const int lockTimeoutMs = 1000;
+
+static volatile sig_atomic_t stopRequested = 0;
+static volatile sig_atomic_t reportRequested = 0;
+
+struct Stats
+{
+    unsigned long beats;
+    unsigned long sent;
+    unsigned long busy;         // The port stayed locked by someone else.
+    unsigned long failed;
+    unsigned long missedTicks;  // Intervals that passed without a beat.
+    long maxLatenessUs;
+    unsigned long buckets[latenessBuckets];
+};
+
+static void onSignal(int signal)
+{
+    if (signal == SIGUSR1)
+        reportRequested = 1;
+    else
+        stopRequested = 1;
+}
+
+static void usage(const char* argv0)
+{
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "Options:\n"
+            "  -d <device>   serial device or usb:<serial> (default /dev/ttyUSB0)\n"
+            "  -b <baud>     baud rate (default 2400)\n"
+            "  -i <ms>       heartbeat interval (default 10000)\n"
+            "  -t <seconds>  set the watchdog timeout on startup\n"
+            "  -p <prio>     run at this SCHED_FIFO priority\n"
+            "  -v            report the lateness of every heartbeat\n"
+            "Send SIGUSR1 to print the lateness histogram.\n",
+            argv0);
+}
+
+// Print without stdio, which may allocate.
+static void say(const char* format, ...) __attribute__((format(printf, 1, 2)));
+static void say(const char* format, ...)
+{
+    char buf[256];
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(buf, sizeof(buf), format, args);
+    va_end(args);
+    if (n > 0 && write(STDERR_FILENO, buf, std::min<size_t>(n, sizeof(buf) - 1)) < 0) {
+        // Nowhere to report it.
+    }
+}
+
+static void report(const Stats& stats)
+{
+    say("%lu heartbeats, %lu sent, %lu locked out, %lu failed, %lu intervals missed, "
+        "max lateness %ld.%03ld ms\n", stats.beats, stats.sent, stats.busy, stats.failed,
+        stats.missedTicks, stats.maxLatenessUs / 1000, stats.maxLatenessUs % 1000);
+    for (int i = 0; i < latenessBuckets; ++i) {
+        if (!stats.buckets[i])
+            continue;
+        if (i < latenessBuckets - 1)
+            say("  < %6ld ms: %lu\n", 1L << i, stats.buckets[i]);
+        else
+            say("  >=%6ld ms: %lu\n", 1L << (i - 1), stats.buckets[i]);
+    }
+}
+
+static long nanosSince(const timespec& a, const timespec& b)
+{
+    return (b.tv_sec - a.tv_sec) * 1000000000L + (b.tv_nsec - a.tv_nsec);
+}
+
+// Touch the stack now, so that it is locked and never faults later.
+static void __attribute__((noinline)) prefaultStack()
+{
+    volatile char stack[64 * 1024];
+    memset((char*)stack, 0, sizeof(stack));
+}
+
+enum class Beat { Sent, Busy, Gone };
+
+// Write the whole command to the non-blocking port and hold the lock
+// while the device handles it.
+static Beat sendBeat(SerialPort& port, const std::string& command, unsigned baud)
+{
+    if (!port.lock(lockTimeoutMs))
+        return Beat::Busy;
+    port.flushInput();
+    size_t written = 0;
+    bool ok = true;
+    while (ok && written < command.size()) {
+        ssize_t n = write(port.fd(), command.data() + written, command.size() - written);
+        if (n >= 0) {
+            written += n;
+        } else if (errno == EAGAIN) {
+            pollfd pfd = { port.fd(), POLLOUT, 0 };
+            ok = poll(&pfd, 1, lockTimeoutMs) > 0 && !(pfd.revents & (POLLHUP | POLLERR));
+        } else if (errno != EINTR) {
+            ok = false;
+        }
+    }
+    // Ten bits per byte on the wire, then the time to handle it.
+    timespec gap = { 0, (long)(command.size() * 10 * (1000000000L / baud)) + commandGapNs };
+    while (gap.tv_nsec >= 1000000000L) {
+        gap.tv_nsec -= 1000000000L;
+        ++gap.tv_sec;
+    }
+    while (ok && EINTR == clock_nanosleep(CLOCK_MONOTONIC, 0, &gap, &gap));
+    port.unlock();
+    return ok ? Beat::Sent : Beat::Gone;
+}
+
+int main(int argc, char** argv)
+{
+    std::string device = "/dev/ttyUSB0";
+    unsigned baud = 2400;
+    long interval = 10000;
+    unsigned timeout = 0;
+    int priority = 0;
+    bool verbose = false;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "d:b:i:t:p:vh")) != -1) {
+        switch (opt) {
+        case 'd': device = optarg; break;
+        case 'b': baud = atoi(optarg); break;
+        case 'i': interval = atol(optarg); break;
+        case 't': timeout = atoi(optarg); break;
+        case 'p': priority = atoi(optarg); break;
+        case 'v': verbose = true; break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (interval <= 0 || baud == 0) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (timeout && interval >= timeout * 1000L) {
+        fprintf(stderr, "The interval must be shorter than the timeout.\n");
+        return 1;
+    }
+
+    const std::string beat = encode(Opcode::reset);
+    SerialPort port;
+    try {
+        std::string path = findSerialDevice(device);
+        if (path.empty())
+            throw std::system_error(ENOENT, std::generic_category(), device);
+        port.open(path, baud, true);
+        if (timeout && sendBeat(port, encode(Opcode::timeout, timeout), baud) != Beat::Sent)
+            throw std::system_error(EIO, std::generic_category(), path);
+    } catch (std::system_error& e) {
+        fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+
+    struct sigaction sa = {};
+    sa.sa_handler = onSignal;
+    sigaction(SIGINT, &sa, nullptr);
+    sigaction(SIGTERM, &sa, nullptr);
+    sigaction(SIGUSR1, &sa, nullptr);
+
+    int timer = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    if (timer < 0) {
+        perror("timerfd_create");
+        return 1;
+    }
+    timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    itimerspec period = {};
+    period.it_interval.tv_sec = interval / 1000;
+    period.it_interval.tv_nsec = interval % 1000 * 1000000;
+    period.it_value = start;
+    if (timerfd_settime(timer, TFD_TIMER_ABSTIME, &period, nullptr) < 0) {
+        perror("timerfd_settime");
+        return 1;
+    }
+
+    if (priority) {
+        sched_param param = {};
+        param.sched_priority = priority;
+        if (sched_setscheduler(0, SCHED_FIFO, &param) < 0)
+            perror("sched_setscheduler");
+    }
+    // The stack and the heap are faulted in before locking; what the
+    // steady state touches is then never paged out.
+    prefaultStack();
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) < 0)
+        perror("mlockall");
+
+    Stats stats = {};
+    unsigned long ticks = 0;
+    bool portOpen = true;
+    while (!stopRequested) {
+        if (reportRequested) {
+            reportRequested = 0;
+            report(stats);
+        }
+
+        uint64_t expirations;
+        if (read(timer, &expirations, sizeof(expirations)) != sizeof(expirations))
+            continue;
+        timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        ticks += expirations;
+        stats.missedTicks += expirations - 1;
+
+        // The timer fired first at the start, so the earliest beat not
+        // yet served was due ticks - expirations intervals later. After
+        // a stall, the lateness is thus the whole gap since the last
+        // beat less one interval, which is what decides on a reset.
+        long lateUs = (nanosSince(start, now)
+                       - (long)(ticks - expirations) * interval * 1000000) / 1000;
+        if (lateUs < 0)
+            lateUs = 0;
+        ++stats.beats;
+        if (lateUs > stats.maxLatenessUs)
+            stats.maxLatenessUs = lateUs;
+        int bucket = 0;
+        while (bucket < latenessBuckets - 1 && lateUs >= 1000L << bucket)
+            ++bucket;
+        ++stats.buckets[bucket];
+
+        // Reopening is the one place that may allocate, but only after
+        // the device has gone away.
+        if (!portOpen) {
+            try {
+                std::string path = findSerialDevice(device);
+                if (!path.empty()) {
+                    port.open(path, baud, true);
+                    portOpen = true;
+                }
+            } catch (std::system_error&) {
+                // Try again at the next heartbeat.
+            }
+        }
+        Beat result = portOpen ? sendBeat(port, beat, baud) : Beat::Gone;
+        if (result == Beat::Sent) {
+            ++stats.sent;
+        } else if (result == Beat::Busy) {
+            ++stats.busy;
+        } else {
+            ++stats.failed;
+            if (portOpen)
+                say("%s: the device has gone away\n", device.c_str());
+            port.close();
+            portOpen = false;
+        }
+        if (verbose)
+            say("heartbeat %s, %ld.%03ld ms late\n",
+                result == Beat::Sent ? "sent" : result == Beat::Busy ? "locked out" : "failed",
+                lateUs / 1000, lateUs % 1000);
+    }
+    report(stats);
+    return 0;
+}
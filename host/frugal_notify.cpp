@@ -0,0 +1,245 @@
+/*
+  Ties the watchdog to the service manager, for systemd hosts. Run as
+  a service with Type=notify and WatchdogSec=, it sends WATCHDOG=1 to
+  the manager every half of WatchdogSec, and a heartbeat to the device
+  right after each one that the manager took. The device's timeout is
+  set to WatchdogSec plus a margin at startup, so it follows the unit
+  file.
+
+  The manager has to read its notification socket to make progress. A
+  notification that is still unread when the next one is due, or one
+  that the socket refuses, means that the manager is stuck, and the
+  heartbeats are withheld until it reads again. The queue is then
+  polled often, so that a heartbeat follows as soon as the manager
+  catches up. Otherwise, the device resets the machine a WatchdogSec
+  plus the margin after the last notification that was read. If this
+  service hangs instead, the manager kills and restarts it after a
+  WatchdogSec, while the device keeps counting. The margin, 5 seconds
+  by default, leaves time for the restart and for the device's tick.
+
+  Stopping the service stops the countdown, unless -N is given.
+*/
+
+#include "Device.h"
+
+#include <cerrno>
+#include <csignal>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <system_error>
+
+#include <linux/sockios.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using namespace frugal;
+
+static volatile sig_atomic_t stopRequested = 0;
+
+static void onSignal(int)
+{
+    stopRequested = 1;
+}
+
+static void usage(const char* argv0)
+{
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "Options:\n"
+            "  -d <device>   serial device or usb:<serial> (default /dev/ttyUSB0)\n"
+            "  -b <baud>     baud rate (default 2400)\n"
+            "  -m <seconds>  add this much to WatchdogSec for the device timeout\n"
+            "                (default 5)\n"
+            "  -r <ms>       wait this long for a vanished device (default 2000)\n"
+            "  -N            keep the countdown running when stopped\n"
+            "  -v            report every heartbeat\n"
+            "NOTIFY_SOCKET and WATCHDOG_USEC are taken from the environment,\n"
+            "as set by systemd for a service with WatchdogSec=.\n",
+            argv0);
+}
+
+// Connects to the socket named by NOTIFY_SOCKET. A leading '@' stands
+// for the abstract namespace.
+static int connectNotifySocket(const std::string& path)
+{
+    sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    if (path.size() < 2 || path.size() >= sizeof(addr.sun_path)
+        || (path[0] != '/' && path[0] != '@'))
+        throw std::system_error(EINVAL, std::generic_category(), "NOTIFY_SOCKET");
+    memcpy(addr.sun_path, path.data(), path.size());
+    if (addr.sun_path[0] == '@')
+        addr.sun_path[0] = 0;
+
+    int fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        throw std::system_error(errno, std::generic_category(), "socket");
+    socklen_t length = offsetof(sockaddr_un, sun_path) + path.size();
+    if (connect(fd, (sockaddr*)&addr, length) < 0) {
+        int err = errno;
+        close(fd);
+        throw std::system_error(err, std::generic_category(), path);
+    }
+    return fd;
+}
+
+// Sends a notification without ever blocking. Returns 0 or an errno
+// value; EAGAIN means that the manager's queue is full.
+static int notify(int fd, const char* message)
+{
+    if (send(fd, message, strlen(message), MSG_DONTWAIT | MSG_NOSIGNAL) < 0)
+        return errno;
+    return 0;
+}
+
+// Whether the manager has read everything sent so far. A datagram
+// counts against the sender's queue until the receiver reads it.
+static bool notificationsRead(int fd)
+{
+    int queued = 0;
+    return ioctl(fd, SIOCOUTQ, &queued) < 0 || queued == 0;
+}
+
+// How often the notification queue is checked while heartbeats are
+// withheld.
+static const long withheldPollNs = 50000000L;
+
+static void addNanos(timespec& t, long ns)
+{
+    t.tv_sec += ns / 1000000000L;
+    t.tv_nsec += ns % 1000000000L;
+    if (t.tv_nsec >= 1000000000L) {
+        t.tv_nsec -= 1000000000L;
+        ++t.tv_sec;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    std::string device = "/dev/ttyUSB0";
+    unsigned baud = 2400;
+    unsigned long margin = 5;
+    Milliseconds reconnectWait(2000);
+    bool nowayout = false;
+    bool verbose = false;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "d:b:m:r:Nvh")) != -1) {
+        switch (opt) {
+        case 'd': device = optarg; break;
+        case 'b': baud = atoi(optarg); break;
+        case 'm': margin = strtoul(optarg, nullptr, 10); break;
+        case 'r': reconnectWait = Milliseconds(atoi(optarg)); break;
+        case 'N': nowayout = true; break;
+        case 'v': verbose = true; break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (optind != argc) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    // As sd_watchdog_enabled() does, WATCHDOG_PID must be ours if set.
+    const char* socketPath = getenv("NOTIFY_SOCKET");
+    const char* usecText = getenv("WATCHDOG_USEC");
+    const char* pidText = getenv("WATCHDOG_PID");
+    unsigned long long usec = usecText ? strtoull(usecText, nullptr, 10) : 0;
+    if (!socketPath || !usec || (pidText && atol(pidText) != getpid())) {
+        fprintf(stderr, "Not run as a service with WatchdogSec=\n");
+        return 1;
+    }
+    unsigned long timeout = (usec + 999999) / 1000000 + margin;
+
+    int notifyFd;
+    try {
+        notifyFd = connectNotifySocket(socketPath);
+    } catch (std::system_error& e) {
+        fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+
+    Device watchdog;
+    watchdog.reconnectWait = reconnectWait;
+    try {
+        watchdog.open(device, baud);
+        watchdog.setTimeout(timeout).get();
+        watchdog.reset().get();
+    } catch (std::system_error& e) {
+        fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+
+    struct sigaction sa = {};
+    sa.sa_handler = onSignal;
+    sigaction(SIGINT, &sa, nullptr);
+    sigaction(SIGTERM, &sa, nullptr);
+
+    std::string ready = "READY=1\nSTATUS=Timeout " + std::to_string(timeout) + " s";
+    notify(notifyFd, ready.c_str());
+    fprintf(stderr, "Watchdog timeout set to %lu s\n", timeout);
+
+    // Heartbeats go out on an absolute schedule, so that a slow one
+    // does not push the others back. While they are withheld, the
+    // schedule starts over from the one that goes out again.
+    timespec next;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    bool withheld = false;
+    while (!stopRequested) {
+        if (withheld) {
+            clock_gettime(CLOCK_MONOTONIC, &next);
+            addNanos(next, withheldPollNs);
+        } else {
+            addNanos(next, usec * 1000 / 2);
+        }
+        if (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, nullptr) == EINTR)
+            continue;
+
+        int err = notificationsRead(notifyFd) ? notify(notifyFd, "WATCHDOG=1") : EAGAIN;
+        if (err) {
+            if (!withheld)
+                fprintf(stderr, "Service manager not responding (%s), withholding heartbeats\n",
+                        strerror(err));
+            withheld = true;
+            continue;
+        }
+        if (withheld)
+            fprintf(stderr, "Service manager responding again\n");
+        withheld = false;
+
+        // The Device drops a port that went away for good.
+        if (!watchdog.isOpen()) {
+            try {
+                watchdog.open(device, baud);
+            } catch (std::system_error& e) {
+                fprintf(stderr, "%s\n", e.what());
+            }
+        }
+        watchdog.reset([verbose](std::error_code error) {
+            if (error)
+                fprintf(stderr, "Heartbeat failed: %s\n", error.message().c_str());
+            else if (verbose)
+                fprintf(stderr, "Heartbeat sent\n");
+        });
+    }
+
+    notify(notifyFd, "STOPPING=1");
+    if (!nowayout) {
+        try {
+            watchdog.send(Opcode::stop).get();
+        } catch (std::system_error& e) {
+            fprintf(stderr, "Could not stop the countdown: %s\n", e.what());
+        }
+    }
+    watchdog.close();
+    close(notifyFd);
+    return 0;
+}
@@ -0,0 +1,213 @@
+/*
+  Round-trip latency measurement for FrugalWatchdog.
+
+  Sends a series of ping commands and matches the replies, which carry
+  the device's clock, to the host's send and receive times. From these,
+  it reports the round-trip time and how much of each direction's delay
+  varies, which tells apart the USB converter and tty layer from the
+  firmware. The device clock is fitted against the host clock first, so
+  its drift does not skew the one-way figures.
+*/
+
+#include "Commands.h"
+#include "Hotplug.h"
+#include "SerialPort.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include <libgen.h>
+#include <unistd.h>
+
+using namespace frugal;
+using Clock = std::chrono::steady_clock;
+
+struct Sample
+{
+    double sent;     // Host time in microseconds.
+    double received;
+    double device;   // Device time in microseconds.
+};
+
+static void usage(const char* argv0)
+{
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "Options:\n"
+            "  -d <device>   serial device or usb:<serial> (default /dev/ttyUSB0)\n"
+            "  -b <baud>     baud rate (default 2400)\n"
+            "  -n <count>    number of pings (default 100)\n"
+            "  -i <ms>       interval between pings (default 200)\n"
+            "  -m            the device is the ATmega328P variant\n"
+            "  -v            print every sample\n",
+            argv0);
+}
+
+static double percentile(std::vector<double> v, double p)
+{
+    std::sort(v.begin(), v.end());
+    size_t i = std::min(v.size() - 1, (size_t)(p / 100 * v.size()));
+    return v[i];
+}
+
+static void printDistribution(const char* what, const std::vector<double>& us)
+{
+    printf("%-24s min %7.1f  median %7.1f  p90 %7.1f  p99 %7.1f  max %7.1f ms\n",
+           what, percentile(us, 0) / 1000, percentile(us, 50) / 1000,
+           percentile(us, 90) / 1000, percentile(us, 99) / 1000,
+           percentile(us, 100) / 1000);
+}
+
+// The FTDI driver buffers received data for up to latency_timer
+// milliseconds before handing it to the host.
+static void printLatencyTimer(const std::string& device)
+{
+    char resolved[PATH_MAX];
+    if (!realpath(device.c_str(), resolved))
+        return;
+    std::string path = std::string("/sys/class/tty/") + basename(resolved)
+        + "/device/latency_timer";
+    std::ifstream timer(path);
+    int ms;
+    if (!(timer >> ms))
+        return;
+    printf("Converter latency timer: %d ms (%s)\n", ms, path.c_str());
+    if (ms > 1)
+        printf("Replies may wait that long in the converter; "
+               "write 1 to the file to lower it.\n");
+}
+
+int main(int argc, char** argv)
+{
+    std::string device = "/dev/ttyUSB0";
+    unsigned baud = 2400;
+    int count = 100;
+    int interval = 200;
+    bool verbose = false;
+    double tickUs = protocol::attinyTickUs;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "d:b:n:i:mvh")) != -1) {
+        switch (opt) {
+        case 'd': device = optarg; break;
+        case 'b': baud = atoi(optarg); break;
+        case 'n': count = atoi(optarg); break;
+        case 'i': interval = atoi(optarg); break;
+        case 'm': tickUs = protocol::atmegaTickUs; break;
+        case 'v': verbose = true; break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (count < 2) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    std::vector<Sample> samples;
+    size_t bytesOut = 0;
+    size_t bytesIn = 0;
+    int lost = 0;
+    int busy = 0;  // The port stayed locked by someone else.
+    try {
+        std::string path = findSerialDevice(device);
+        if (path.empty())
+            throw std::system_error(ENOENT, std::generic_category(), device);
+        device = path;
+        SerialPort port(device, baud);
+        auto start = Clock::now();
+        auto since = [&](Clock::time_point t) {
+            return (double)std::chrono::duration_cast<std::chrono::microseconds>(
+                t - start).count();
+        };
+
+        // The port is only locked around each exchange, so that the
+        // heartbeats of others get through during a long run.
+        for (int seq = 0; seq < count; ++seq) {
+            if (seq)
+                std::this_thread::sleep_for(std::chrono::milliseconds(interval));
+            if (!port.lock(1000)) {
+                ++busy;
+                continue;
+            }
+            port.flushInput();
+            std::string command = encode(Opcode::ping, seq);
+            auto sent = Clock::now();
+            port.write(command);
+
+            std::vector<std::string> lines(1);
+            PingReply reply;
+            bool matched = false;
+            while (!matched && port.readLine(lines[0], 2000))
+                matched = decode(lines, reply) && reply.argument == std::to_string(seq);
+            auto received = Clock::now();
+            port.unlock();
+            if (!matched) {
+                ++lost;
+                continue;
+            }
+
+            Sample s = { since(sent), since(received), reply.ticks * tickUs + reply.us };
+            samples.push_back(s);
+            bytesOut = command.size();
+            bytesIn = lines[0].size() + 2;
+            if (verbose)
+                printf("%d: rtt %.1f ms, device time %.1f ms\n", seq,
+                       (s.received - s.sent) / 1000, s.device / 1000);
+        }
+    } catch (std::system_error& e) {
+        fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+
+    printf("Samples: %zu, lost: %d, locked out: %d\n", samples.size(), lost, busy);
+    if (samples.size() < 2)
+        return 1;
+
+    // Fit the device clock to the midpoints of the exchanges.
+    double n = samples.size();
+    double sx = 0, sy = 0, sxx = 0, sxy = 0;
+    for (auto& s : samples) {
+        double x = (s.sent + s.received) / 2;
+        sx += x;
+        sy += s.device;
+        sxx += x * x;
+        sxy += x * s.device;
+    }
+    double slope = (n * sxy - sx * sy) / (n * sxx - sx * sx);
+    double offset = (sy - slope * sx) / n;
+
+    std::vector<double> rtt, forward, backward;
+    for (auto& s : samples) {
+        double device = (s.device - offset) / slope;
+        rtt.push_back(s.received - s.sent);
+        forward.push_back(device - s.sent);
+        backward.push_back(s.received - device);
+    }
+    // Only the variation of the one-way delays is known.
+    double minForward = percentile(forward, 0);
+    double minBackward = percentile(backward, 0);
+    for (auto& f : forward)
+        f -= minForward;
+    for (auto& b : backward)
+        b -= minBackward;
+
+    printDistribution("Round trip:", rtt);
+    printDistribution("Host to device, excess:", forward);
+    printDistribution("Device to host, excess:", backward);
+    printf("Time on the wire: %.1f ms to the device, %.1f ms back\n",
+           bytesOut * 10000.0 / baud, bytesIn * 10000.0 / baud);
+    printf("Device clock error: %+.0f ppm\n", (slope - 1) * 1e6);
+    printLatencyTimer(device);
+    return 0;
+}
@@ -0,0 +1,192 @@
+/*
+  Replays traces of serial traffic recorded by libfrugal.
+
+  Plays one side of the recorded conversation with its original
+  timing, either into a new pseudo-terminal or into an existing tty,
+  and prints what the other side answers. Playing the host's side
+  drives a device, a firmware build or an emulator through exactly
+  what the host sent, so that timing-dependent failures can be
+  reproduced; playing the device's side feeds host tools with its
+  recorded replies.
+*/
+
+#include "Pty.h"
+#include "SerialPort.h"
+#include "Trace.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include <poll.h>
+#include <unistd.h>
+
+using namespace frugal;
+
+// Replies that come after the last played record are still printed
+// for this long.
+static const int trailingMs = 1000;
+
+static void usage(const char* argv0)
+{
+    fprintf(stderr,
+            "Usage: %s [options] trace...\n"
+            "Options:\n"
+            "  -d <tty>      replay into this tty instead of a new pseudo-terminal\n"
+            "  -s <side>     play the host's (host, default) or the device's side (device)\n"
+            "  -w            space the bytes as on the wire at the trace's baud rate\n"
+            "  -p            print the traces instead of replaying them\n"
+            "Give the rotated file (trace.1) before the current one.\n",
+            argv0);
+}
+
+static uint64_t monotonicUs()
+{
+    timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000ULL + t.tv_nsec / 1000;
+}
+
+static void print(double us, Direction direction, const std::string& data)
+{
+    std::string text;
+    for (unsigned char c : data) {
+        char escaped[8];
+        if (c == '\r')
+            text += "\\r";
+        else if (c == '\n')
+            text += "\\n";
+        else if (c < ' ' || c >= 0x7f || c == '\\') {
+            snprintf(escaped, sizeof(escaped), "\\x%02x", c);
+            text += escaped;
+        } else {
+            text += c;
+        }
+    }
+    printf("%10.3f %c %s\n", us / 1e6,
+           direction == Direction::ToDevice ? '>' : '<', text.c_str());
+}
+
+int main(int argc, char** argv)
+{
+    std::string tty;
+    Direction played = Direction::ToDevice;
+    bool wire = false;
+    bool printOnly = false;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "d:s:wph")) != -1) {
+        switch (opt) {
+        case 'd': tty = optarg; break;
+        case 's':
+            played = std::string(optarg) == "device"
+                ? Direction::FromDevice : Direction::ToDevice;
+            break;
+        case 'w': wire = true; break;
+        case 'p': printOnly = true; break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (optind == argc) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    std::vector<TraceReader::Record> records;
+    unsigned baud = 2400;
+    try {
+        for (int i = optind; i < argc; ++i) {
+            TraceReader reader(argv[i]);
+            baud = reader.baud();
+            TraceReader::Record record;
+            while (reader.next(record))
+                records.push_back(record);
+        }
+    } catch (std::system_error& e) {
+        fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+    if (records.empty())
+        return 0;
+
+    uint64_t first = records.front().us;
+    if (printOnly) {
+        for (auto& record : records)
+            print(record.us - first, record.direction, record.data);
+        return 0;
+    }
+
+    SerialPort port;
+    int fd;
+    try {
+        if (tty.empty()) {
+            std::string name;
+            fd = openPty(name);
+            fprintf(stderr, "Replaying into %s once it is opened.\n", name.c_str());
+            waitForPtyPeer(fd);
+        } else {
+            port.open(tty, baud);
+            fd = port.fd();
+        }
+    } catch (std::system_error& e) {
+        fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+
+    Direction heard = played == Direction::ToDevice
+        ? Direction::FromDevice : Direction::ToDevice;
+    uint64_t byteUs = 10000000ULL / baud;
+    uint64_t start = monotonicUs();
+
+    // Print what the other side says until the given time.
+    auto listen = [&](uint64_t until) {
+        for (;;) {
+            uint64_t now = monotonicUs();
+            if (now >= until)
+                return true;
+            pollfd pfd = { fd, POLLIN, 0 };
+            if (poll(&pfd, 1, (until - now + 999) / 1000) < 0 && errno != EINTR)
+                return false;
+            if (pfd.revents & POLLIN) {
+                char buf[64];
+                ssize_t n = read(fd, buf, sizeof(buf));
+                if (n > 0)
+                    print(monotonicUs() - start, heard, std::string(buf, n));
+            } else if (pfd.revents & (POLLHUP | POLLERR)) {
+                fprintf(stderr, "The other end has gone away.\n");
+                return false;
+            }
+        }
+    };
+
+    for (auto& record : records) {
+        if (record.direction != played)
+            continue;
+        if (!listen(start + record.us - first))
+            return 1;
+        print(monotonicUs() - start, played, record.data);
+        if (!wire) {
+            if (write(fd, record.data.data(), record.data.size()) < 0)
+                perror("write");
+            continue;
+        }
+        uint64_t next = monotonicUs();
+        for (char c : record.data) {
+            if (!listen(next))
+                return 1;
+            if (write(fd, &c, 1) < 0)
+                perror("write");
+            next += byteUs;
+        }
+    }
+    listen(monotonicUs() + trailingMs * 1000);
+    if (tty.empty())
+        close(fd);
+    return 0;
+}
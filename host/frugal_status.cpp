@@ -0,0 +1,113 @@
+/*
+  Prints the state of the watchdog as last published by frugal_health
+  -s, without touching the serial line. The elapsed time is brought up
+  to date from the age of the state, so it is exact between the
+  status queries of the daemon. If the daemon has stopped publishing,
+  the state is printed as it was last known.
+
+  The exit status is 0 if the link to the device is up, 2 if it is
+  down or the daemon has stopped, and 1 if no state is available.
+*/
+
+#include "StatusCache.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <system_error>
+
+#include <unistd.h>
+
+using namespace frugal;
+
+static void usage(const char* argv0)
+{
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "Options:\n"
+            "  -s <name>  shared memory segment (default /frugal_watchdog)\n"
+            "  -k         print key=value lines for scripts\n",
+            argv0);
+}
+
+static uint64_t monotonicNs()
+{
+    timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
+static std::string formatTime(uint64_t epoch)
+{
+    if (!epoch)
+        return "never";
+    time_t t = epoch;
+    char buf[64];
+    strftime(buf, sizeof(buf), "%c", localtime(&t));
+    return buf;
+}
+
+int main(int argc, char** argv)
+{
+    std::string name = "/frugal_watchdog";
+    bool keys = false;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "s:kh")) != -1) {
+        switch (opt) {
+        case 's': name = optarg; break;
+        case 'k': keys = true; break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    DeviceState state;
+    try {
+        StatusReader reader(name);
+        if (!reader.read(state)) {
+            fprintf(stderr, "%s: no state published\n", name.c_str());
+            return 1;
+        }
+    } catch (std::system_error& e) {
+        fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+
+    uint64_t now = monotonicNs();
+    double age = (now - state.updatedNs) / 1e9;
+    double contactAge = (now - state.lastContactNs) / 1e9;
+    bool stale = isStale(state, now);
+    bool linkUp = state.linkUp && !stale;
+    unsigned long elapsed = state.elapsed;
+    if (state.armed && state.updatedNs && !stale)
+        elapsed = std::min<unsigned long>(state.timeout, elapsed + (unsigned long)age);
+
+    if (keys) {
+        printf("elapsed=%lu\ntimeout=%u\narmed=%u\nlast_heartbeat=%llu\n"
+               "last_timeout=%llu\nlink=%s\nfailures=%u\nage=%.3f\n",
+               elapsed, state.timeout, state.armed,
+               (unsigned long long)state.lastHeartbeat,
+               (unsigned long long)state.lastTimeout,
+               stale ? "stale" : linkUp ? "up" : "down", state.failures, age);
+    } else {
+        printf("%lu / %u%s\n", elapsed, state.timeout, state.armed ? "" : " (stopped)");
+        printf("Last heartbeat: %s\n", formatTime(state.lastHeartbeat).c_str());
+        printf("Last timeout: %s\n", formatTime(state.lastTimeout).c_str());
+        if (stale) {
+            printf("Link: unknown, nothing published for %.1f s\n",
+                   (now - state.publishedNs) / 1e9);
+        } else if (linkUp) {
+            printf("Link: up, status read %.1f s ago\n", age);
+        } else {
+            printf("Link: down after %u failures (%s), last contact %.1f s ago\n",
+                   state.failures, strerror(state.lastError),
+                   state.lastContactNs ? contactAge : 0.0);
+        }
+    }
+    return linkUp ? 0 : 2;
+}
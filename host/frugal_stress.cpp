@@ -0,0 +1,345 @@
+/*
+  Measures how well a heartbeat implementation keeps its deadlines
+  while the host is under pressure.
+
+  The heartbeat command runs against an emulated device on a
+  pseudo-terminal, either once as a daemon or, with -e, again in every
+  interval the way watchdog(8) runs its test scripts. Meanwhile,
+  stressor processes saturate the CPU, memory, the process table or
+  the disk. The time between heartbeats as seen by the device gives
+  the lateness distribution and the number of resets that would have
+  happened with the given timeout.
+*/
+
+#include "DeviceEmulator.h"
+#include "Pty.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace frugal;
+
+static void usage(const char* argv0)
+{
+    fprintf(stderr,
+            "Usage: %s [options] -- command [args...]\n"
+            "Options:\n"
+            "  -i <ms>        intended heartbeat interval (default 10000)\n"
+            "  -e             run the command in every interval, like watchdog(8)\n"
+            "  -t <seconds>   watchdog timeout for counting resets (default 60)\n"
+            "  -T <seconds>   duration of the run (default 300)\n"
+            "  -s <stressor>  apply a stressor, may be repeated:\n"
+            "                   cpu:<n>     n processes spinning\n"
+            "                   mem:<MiB>   this much memory touched continuously\n"
+            "                   fork:<n>    up to n short-lived processes at a time\n"
+            "                   io:<MiB>    files of this size written and synced\n"
+            "  -w <dir>       directory for the io stressor (default /tmp)\n"
+            "In the command, {} is replaced by the emulated device, which is\n"
+            "also exported as FRUGAL_SERIAL.\n",
+            argv0);
+}
+
+static uint64_t monotonicUs()
+{
+    timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000ULL + t.tv_nsec / 1000;
+}
+
+static double percentile(std::vector<double> v, double p)
+{
+    std::sort(v.begin(), v.end());
+    size_t i = std::min(v.size() - 1, (size_t)(p / 100 * v.size()));
+    return v[i];
+}
+
+// The processes to take down if frugal_stress is interrupted.
+static volatile pid_t stressGroup = 0;
+static volatile pid_t commandPid = 0;
+
+static void onSignal(int signal)
+{
+    if (stressGroup)
+        kill(-stressGroup, SIGKILL);
+    if (commandPid)
+        kill(commandPid, SIGTERM);
+    ::signal(signal, SIG_DFL);
+    raise(signal);
+}
+
+// Stressors run in processes of their own until they are killed.
+static void stressCpu()
+{
+    for (volatile unsigned long i = 0;; ++i);
+}
+
+static void stressMemory(size_t mib)
+{
+    size_t size = mib << 20;
+    char* p = (char*)malloc(size);
+    if (!p)
+        _exit(1);
+    long page = sysconf(_SC_PAGESIZE);
+    for (char c = 0;; ++c) {
+        for (size_t i = 0; i < size; i += page)
+            p[i] = c;
+    }
+}
+
+static void stressFork(int n)
+{
+    int alive = 0;
+    for (;;) {
+        while (alive < n) {
+            pid_t pid = fork();
+            if (pid == 0) {
+                usleep(10000);
+                _exit(0);
+            }
+            if (pid < 0)
+                break;
+            ++alive;
+        }
+        if (wait(nullptr) > 0)
+            --alive;
+    }
+}
+
+static void stressIo(size_t mib, const std::string& dir)
+{
+    std::string path = dir + "/frugal_stress." + std::to_string(getpid());
+    std::vector<char> block(1 << 20, 'x');
+    for (;;) {
+        int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+        if (fd < 0)
+            _exit(1);
+        for (size_t i = 0; i < mib; ++i) {
+            if (write(fd, block.data(), block.size()) < 0)
+                break;
+        }
+        fsync(fd);
+        close(fd);
+        unlink(path.c_str());
+    }
+}
+
+// Start the stressors in a process group of their own. Returns the
+// group, or 0 if there are none.
+static pid_t startStressors(const std::vector<std::string>& specs, const std::string& dir)
+{
+    pid_t group = 0;
+    for (auto& spec : specs) {
+        auto colon = spec.find(':');
+        std::string kind = spec.substr(0, colon);
+        long n = colon == std::string::npos ? 1 : atol(spec.c_str() + colon + 1);
+        int processes = kind == "cpu" ? n : 1;
+        for (int i = 0; i < processes; ++i) {
+            pid_t pid = fork();
+            if (pid < 0) {
+                perror("fork");
+                continue;
+            }
+            if (pid == 0) {
+                setpgid(0, group);
+                // Also die with frugal_stress when it is killed outright.
+                prctl(PR_SET_PDEATHSIG, SIGKILL);
+                if (getppid() == 1)
+                    _exit(0);
+                if (kind == "cpu")
+                    stressCpu();
+                else if (kind == "mem")
+                    stressMemory(n);
+                else if (kind == "fork")
+                    stressFork(n);
+                else if (kind == "io")
+                    stressIo(n, dir);
+                _exit(0);
+            }
+            setpgid(pid, group);
+            if (!group)
+                group = pid;
+        }
+    }
+    return group;
+}
+
+static pid_t spawn(const std::vector<std::string>& command)
+{
+    std::vector<char*> argv;
+    for (auto& arg : command)
+        argv.push_back(const_cast<char*>(arg.c_str()));
+    argv.push_back(nullptr);
+    pid_t pid = fork();
+    if (pid == 0) {
+        execvp(argv[0], argv.data());
+        perror(argv[0]);
+        _exit(127);
+    }
+    return pid;
+}
+
+int main(int argc, char** argv)
+{
+    long interval = 10000;
+    bool execEach = false;
+    long timeout = 60;
+    long duration = 300;
+    std::vector<std::string> stressors;
+    std::string dir = "/tmp";
+
+    int opt;
+    while ((opt = getopt(argc, argv, "i:et:T:s:w:h")) != -1) {
+        switch (opt) {
+        case 'i': interval = atol(optarg); break;
+        case 'e': execEach = true; break;
+        case 't': timeout = atol(optarg); break;
+        case 'T': duration = atol(optarg); break;
+        case 's': stressors.push_back(optarg); break;
+        case 'w': dir = optarg; break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (optind == argc || interval <= 0 || timeout <= 0 || duration <= 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    std::string ptyName;
+    int master;
+    try {
+        master = openPty(ptyName);
+    } catch (std::system_error& e) {
+        fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+    // Keep the other end open, so that the master does not hang up
+    // between runs of the command.
+    int peer = open(ptyName.c_str(), O_RDWR | O_NOCTTY | O_CLOEXEC);
+    setenv("FRUGAL_SERIAL", ptyName.c_str(), 1);
+    std::vector<std::string> command(argv + optind, argv + argc);
+    for (auto& arg : command) {
+        if (arg == "{}")
+            arg = ptyName;
+    }
+
+    // The device runs in a thread at the highest priority available,
+    // so that the stressors do not delay its timestamps.
+    DeviceEmulator device;
+    std::vector<uint64_t> beats;
+    beats.reserve(duration * 1000 / interval * 4 + 16);
+    std::atomic<bool> stop(false);
+    std::thread emulator([&] {
+        sched_param param = {};
+        param.sched_priority = sched_get_priority_max(SCHED_FIFO);
+        if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) != 0)
+            fprintf(stderr, "Warning: the emulated device runs without real-time priority.\n");
+        std::string reply;
+        while (!stop) {
+            pollfd pfd = { master, POLLIN, 0 };
+            if (poll(&pfd, 1, 100) <= 0)
+                continue;
+            char buf[256];
+            ssize_t n = read(master, buf, sizeof(buf));
+            if (n <= 0)
+                continue;
+            unsigned long before = device.heartbeats();
+            reply.clear();
+            device.input(buf, n, monotonicUs(), reply);
+            if (device.heartbeats() != before)
+                beats.push_back(device.lastHeartbeat());
+            if (!reply.empty() && write(master, reply.data(), reply.size()) < 0) {
+                // Nobody is listening.
+            }
+        }
+    });
+
+    struct sigaction sa = {};
+    sa.sa_handler = onSignal;
+    sigaction(SIGINT, &sa, nullptr);
+    sigaction(SIGTERM, &sa, nullptr);
+    stressGroup = startStressors(stressors, dir);
+    uint64_t start = monotonicUs();
+    uint64_t end = start + duration * 1000000ULL;
+    if (execEach) {
+        // Like watchdog(8), run the command and wait for it, then
+        // sleep for the rest of the interval.
+        for (uint64_t next = start; monotonicUs() < end; next += interval * 1000) {
+            pid_t pid = commandPid = spawn(command);
+            if (pid > 0)
+                waitpid(pid, nullptr, 0);
+            commandPid = 0;
+            uint64_t now = monotonicUs();
+            if (next + interval * 1000 > now)
+                usleep(next + interval * 1000 - now);
+        }
+    } else {
+        pid_t pid = commandPid = spawn(command);
+        while (monotonicUs() < end)
+            usleep(100000);
+        if (pid > 0) {
+            kill(pid, SIGTERM);
+            waitpid(pid, nullptr, 0);
+            commandPid = 0;
+        }
+    }
+    end = monotonicUs();
+    if (pid_t group = stressGroup) {
+        stressGroup = 0;
+        kill(-group, SIGKILL);
+        while (waitpid(-group, nullptr, 0) > 0);
+    }
+    stop = true;
+    emulator.join();
+    close(peer);
+    close(master);
+
+    // The gaps include the one from the start to the first heartbeat
+    // and the one from the last heartbeat to the end.
+    std::vector<double> lateness;
+    long resets = 0;
+    double maxGap = 0;
+    uint64_t previous = start;
+    beats.push_back(end);
+    for (auto beat : beats) {
+        double gap = (beat - previous) / 1000.0;
+        previous = beat;
+        if (gap > timeout * 1000.0)
+            ++resets;
+        maxGap = std::max(maxGap, gap);
+        if (beat != end)
+            lateness.push_back(std::max(0.0, gap - interval));
+    }
+    // The first gap is the startup time.
+    if (!lateness.empty())
+        lateness.erase(lateness.begin());
+
+    printf("Heartbeats: %zu in %.1f s, longest gap %.1f ms\n", beats.size() - 1,
+           (end - start) / 1e6, maxGap);
+    if (!lateness.empty()) {
+        printf("Lateness: p50 %.1f  p90 %.1f  p99 %.1f  p99.9 %.1f  max %.1f ms\n",
+               percentile(lateness, 50), percentile(lateness, 90),
+               percentile(lateness, 99), percentile(lateness, 99.9),
+               percentile(lateness, 100));
+    }
+    printf("Would-be false resets with a %ld s timeout: %ld\n", timeout, resets);
+    return 0;
+}
@@ -23,6 +23,7 @@
 #define FAST_PINS_H
 
 #include <avr/io.h>
+#include <avr/interrupt.h>
 
 /* This header provides MCU-specific implementations of a FastPin
    class which looks like
@@ -72,6 +73,32 @@
    As FastPin can be implicitly cast to a FastAnyPin, the functor can
    always take the latter as argument, but that will compile into
    function calls. Still faster than Arduino's digitalWrite though ...
+
+   If C++11 or later is used, a FastPinGroup struct is also provided.
+   It looks like
+
+   template<uint8_t... pins>
+   struct FastPinGroup
+   {
+       static void high();
+       static void low();
+       static void toggle();
+       static void set(bool high);
+       static void output();
+       static void input();
+       static void direction(bool out);
+       static constexpr uint8_t mask(uint8_t port);
+   }
+
+   It operates on all the listed pins at once. The pins are sorted
+   into ports at compile time, and each port is written with a single
+   masked read-modify-write. Interrupts are disabled during the write,
+   so the pins on one port always switch together, and the write does
+   not race with interrupts touching other pins on the same port. If
+   only one pin of the group lives on a port, a single sbi/cbi is
+   used like in FastPin. Toggling is done by writing the mask to the
+   PIN register, which takes a single instruction per port and does
+   not need to disable interrupts.
 */
 
 #define FAST_SET(reg, bit) ((reg) |= _BV((bit)))
@@ -100,6 +127,12 @@ struct FastPin;
    following macro can then be used to define the the FastPin struct.
 
    The implementation for ATtiny24 et al. should make this clearer :)
+
+   For FastPinGroup, the MCU must also define FAST_PINS_PORT_OF(pin)
+   and FAST_PINS_BIT_OF(pin), constant expressions giving the index of
+   the port and the bit number of a pin, and
+   FAST_PINS_GROUP_PATTERN(typ, op), which calls
+   FAST_PINS_GROUP_ ## op (register, port index) for every port.
 */
 
 #define FAST_PINS_DEFINE_STRUCT                                         \
@@ -172,6 +205,7 @@ struct FastPin;
     } else {					\
 	FAST_ ## op (typ ## B, (10-pin));	\
     }
+#define FAST_PINS_BIT_OF(pin) ((pin) < 8 ? (pin) : 10-(pin))
 #else
 #define FAST_PINS_MAXPIN 12
 #define FAST_PINS_IF_PATTERN(typ, op)		\
@@ -180,8 +214,14 @@ struct FastPin;
     } else {					\
 	FAST_ ## op (typ ## B, (pin-8));	\
     }
+#define FAST_PINS_BIT_OF(pin) ((pin) < 8 ? (pin) : (pin)-8)
 #endif
 
+#define FAST_PINS_PORT_OF(pin) ((pin) < 8 ? 0 : 1)
+#define FAST_PINS_GROUP_PATTERN(typ, op)	\
+    FAST_PINS_GROUP_ ## op (typ ## A, 0)	\
+    FAST_PINS_GROUP_ ## op (typ ## B, 1)
+
 FAST_PINS_DEFINE_STRUCT
 
 #elif defined (__AVR_ATtiny25__) || defined (__AVR_ATtiny45__) || defined (__AVR_ATtiny85__)
@@ -198,6 +238,10 @@ FAST_PINS_DEFINE_STRUCT
 // For this MCU, the pattern is essentially a no-op.
 #define FAST_PINS_IF_PATTERN(typ, op) FAST_ ## op (typ ## B, pin);
 
+#define FAST_PINS_PORT_OF(pin) 0
+#define FAST_PINS_BIT_OF(pin) (pin)
+#define FAST_PINS_GROUP_PATTERN(typ, op) FAST_PINS_GROUP_ ## op (typ ## B, 0)
+
 FAST_PINS_DEFINE_STRUCT
 
 #elif defined (__AVR_ATmega328P__) || defined (__AVR_ATmega328__)
@@ -210,6 +254,11 @@ FAST_PINS_DEFINE_STRUCT
     } else {					\
 	FAST_ ## op (typ ## B, (pin-8));	\
     }
+#define FAST_PINS_PORT_OF(pin) ((pin) < 8 ? 0 : 1)
+#define FAST_PINS_BIT_OF(pin) ((pin) < 8 ? (pin) : (pin)-8)
+#define FAST_PINS_GROUP_PATTERN(typ, op)	\
+    FAST_PINS_GROUP_ ## op (typ ## D, 0)	\
+    FAST_PINS_GROUP_ ## op (typ ## B, 1)
 #else
 #define FAST_PINS_MAXPIN 24
 #define FAST_PINS_IF_PATTERN(typ, op)		\
@@ -220,6 +269,13 @@ FAST_PINS_DEFINE_STRUCT
     } else {					\
 	FAST_ ## op (typ ## D, (pin-15));	\
     }
+#define FAST_PINS_PORT_OF(pin) ((pin) < 8 ? 0 : (pin) < 15 ? 1 : 2)
+#define FAST_PINS_BIT_OF(pin)			\
+    ((pin) < 8 ? (pin) : (pin) < 15 ? (pin)-8 : (pin)-15)
+#define FAST_PINS_GROUP_PATTERN(typ, op)	\
+    FAST_PINS_GROUP_ ## op (typ ## B, 0)	\
+    FAST_PINS_GROUP_ ## op (typ ## C, 1)	\
+    FAST_PINS_GROUP_ ## op (typ ## D, 2)
 #endif
 
 FAST_PINS_DEFINE_STRUCT
@@ -228,8 +284,90 @@ FAST_PINS_DEFINE_STRUCT
 #error "FastPins does not support this MCU."
 #endif
 
+
+// Pin groups.
+
+#if __cplusplus > 199711L
+
+constexpr uint8_t fast_pins_mask(uint8_t) { return 0; }
+
+// Mask of the listed pins that live on the given port.
+template <typename... Pins>
+constexpr uint8_t fast_pins_mask(uint8_t port, uint8_t pin, Pins... rest)
+{
+    return (FAST_PINS_PORT_OF(pin) == port ? _BV(FAST_PINS_BIT_OF(pin)) : 0)
+        | fast_pins_mask(port, rest...);
+}
+
+constexpr bool fast_pins_valid() { return true; }
+
+template <typename... Pins>
+constexpr bool fast_pins_valid(uint8_t pin, Pins... rest)
+{
+    return pin < FAST_PINS_MAXPIN && fast_pins_valid(rest...);
+}
+
+// Writes the masked bits of a port. A write to a single bit compiles
+// to sbi/cbi, which is atomic on its own. A proper read-modify-write is
+// protected against interrupts.
+#define FAST_PINS_GROUP_RMW(port, stmt)         \
+    {                                           \
+        constexpr uint8_t m = mask(port);       \
+        if (m & (m - 1)) {                      \
+            uint8_t sreg = SREG;                \
+            cli();                              \
+            stmt;                               \
+            SREG = sreg;                        \
+        } else if (m) {                         \
+            stmt;                               \
+        }                                       \
+    }
+#define FAST_PINS_GROUP_SET(reg, port) FAST_PINS_GROUP_RMW(port, (reg) |= m)
+#define FAST_PINS_GROUP_CLR(reg, port) FAST_PINS_GROUP_RMW(port, (reg) &= ~m)
+// Writing ones to PIN toggles the corresponding bits of PORT.
+#define FAST_PINS_GROUP_TGL(reg, port)          \
+    {                                           \
+        constexpr uint8_t m = mask(port);       \
+        if (m) {                                \
+            (reg) = m;                          \
+        }                                       \
+    }
+
+template <uint8_t... pins>
+struct FastPinGroup
+{
+    static_assert(fast_pins_valid(pins...),
+                  "Pin number too high for this MCU.");
+    static constexpr uint8_t mask(uint8_t port)
+        { return fast_pins_mask(port, pins...); }
+    static __attribute__((always_inline)) void high()
+        { FAST_PINS_GROUP_PATTERN(PORT, SET) }
+    static __attribute__((always_inline)) void low()
+        { FAST_PINS_GROUP_PATTERN(PORT, CLR) }
+    static __attribute__((always_inline)) void toggle()
+        { FAST_PINS_GROUP_PATTERN(PIN, TGL) }
+    static __attribute__((always_inline)) void set(bool h)
+        { if (h) high(); else low(); }
+    static __attribute__((always_inline)) void output()
+        { FAST_PINS_GROUP_PATTERN(DDR, SET) }
+    static __attribute__((always_inline)) void input()
+        { FAST_PINS_GROUP_PATTERN(DDR, CLR) }
+    static __attribute__((always_inline)) void direction(bool out)
+        { if (out) output(); else input(); }
+};
+
+#undef FAST_PINS_GROUP_RMW
+#undef FAST_PINS_GROUP_SET
+#undef FAST_PINS_GROUP_CLR
+#undef FAST_PINS_GROUP_TGL
+
+#endif
+
 #undef FAST_PINS_STRUCT_PATTERN
 #undef FAST_PINS_IF_PATTERN
+#undef FAST_PINS_GROUP_PATTERN
+#undef FAST_PINS_PORT_OF
+#undef FAST_PINS_BIT_OF
 
 
 // For loop over pins.
@@ -0,0 +1,150 @@
+// HwUart.h
+// Interrupt-driven hardware USART with the same interface as SoftUart,
+// so the rest of the firmware does not care which one it uses.
+// Received and transmitted characters are buffered; the CPU is only
+// interrupted once per character. The baud rate is checked at compile
+// time.
+
+#ifndef HW_UART_H
+#define HW_UART_H
+
+#include <avr/interrupt.h>
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+
+#if !defined (__AVR_ATmega328P__) && !defined (__AVR_ATmega328__)
+    #error "no USART definitions available for this AVR"
+#endif
+
+// Defines the USART interrupts for the given HwUart type. Use it once,
+// at file scope.
+#define HWUART_ISR(uart)				\
+    ISR(USART_RX_vect) { uart::rxIsr(); }		\
+    ISR(USART_UDRE_vect) { uart::udreIsr(); }
+
+template<unsigned long baud, uint8_t rxBufSize = 32, uint8_t txBufSize = 32>
+class HwUart
+{
+ public:
+    static void init()
+    {
+	UBRR0 = ubrr;
+	UCSR0A = _BV(U2X0);
+	UCSR0C = _BV(UCSZ01) | _BV(UCSZ00);  // 8N1
+	UCSR0B = _BV(TXEN0) | _BV(RXEN0) | _BV(RXCIE0);
+    }
+
+    static void rxOn()
+    {
+	UCSR0B |= _BV(RXEN0) | _BV(RXCIE0);
+    }
+
+    static void rxOff()
+    {
+	UCSR0B &= ~(_BV(RXEN0) | _BV(RXCIE0));
+    }
+
+    static bool available()
+    {
+	return rxHead != rxTail;
+    }
+
+    static char get()
+    {
+	while (rxHead == rxTail);
+	char c = rxbuf[rxTail];
+	rxTail = (rxTail + 1) & (rxBufSize - 1);
+	return c;
+    }
+
+    static void flushInput()
+    {
+	rxTail = rxHead;
+    }
+
+    static bool transmitBusy()
+    {
+	return txHead != txTail;
+    }
+
+    static void put(char c)
+    {
+	uint8_t next = (txHead + 1) & (txBufSize - 1);
+	// Wait for the interrupt to make room.
+	while (next == txTail);
+	txbuf[txHead] = c;
+	txHead = next;
+	UCSR0B |= _BV(UDRIE0);
+    }
+
+    static void puts(const char* str)
+    {
+	while (*str)
+	    put(*str++);
+    }
+
+    static void puts_P(const char* str)
+    {
+	char c;
+	while ((c = pgm_read_byte(str++)))
+	    put(c);
+    }
+
+    static inline void rxIsr() __attribute__((always_inline))
+    {
+	char c = UDR0;
+	uint8_t next = (rxHead + 1) & (rxBufSize - 1);
+	// Drop the character if the buffer is full.
+	if (next != rxTail) {
+	    rxbuf[rxHead] = c;
+	    rxHead = next;
+	}
+    }
+
+    static inline void udreIsr() __attribute__((always_inline))
+    {
+	if (txHead == txTail) {
+	    UCSR0B &= ~_BV(UDRIE0);
+	    return;
+	}
+	UDR0 = txbuf[txTail];
+	txTail = (txTail + 1) & (txBufSize - 1);
+    }
+
+ private:
+    // Double speed mode gives the smallest error for common crystals.
+    static constexpr unsigned long ubrr = (F_CPU + 4 * baud) / (8 * baud) - 1;
+    // Actual baud rate in thousandths of the requested one.
+    static constexpr unsigned long long baudPermille =
+	F_CPU * 1000ULL / (8ULL * (ubrr + 1)) / baud;
+
+    static_assert(ubrr <= 0xfff, "Baud rate too low for this F_CPU.");
+    static_assert(baudPermille >= 975 && baudPermille <= 1025,
+		  "Baud rate cannot be reached within 2.5% with this F_CPU.");
+    static_assert(rxBufSize && !(rxBufSize & (rxBufSize - 1))
+		  && txBufSize && !(txBufSize & (txBufSize - 1)),
+		  "Buffer sizes must be powers of two.");
+
+    static volatile char rxbuf[rxBufSize];
+    static volatile uint8_t rxHead;
+    static volatile uint8_t rxTail;
+
+    static volatile char txbuf[txBufSize];
+    static volatile uint8_t txHead;
+    static volatile uint8_t txTail;
+};
+
+template<unsigned long baud, uint8_t rxBufSize, uint8_t txBufSize>
+volatile char HwUart<baud, rxBufSize, txBufSize>::rxbuf[rxBufSize];
+template<unsigned long baud, uint8_t rxBufSize, uint8_t txBufSize>
+volatile uint8_t HwUart<baud, rxBufSize, txBufSize>::rxHead;
+template<unsigned long baud, uint8_t rxBufSize, uint8_t txBufSize>
+volatile uint8_t HwUart<baud, rxBufSize, txBufSize>::rxTail;
+template<unsigned long baud, uint8_t rxBufSize, uint8_t txBufSize>
+volatile char HwUart<baud, rxBufSize, txBufSize>::txbuf[txBufSize];
+template<unsigned long baud, uint8_t rxBufSize, uint8_t txBufSize>
+volatile uint8_t HwUart<baud, rxBufSize, txBufSize>::txHead;
+template<unsigned long baud, uint8_t rxBufSize, uint8_t txBufSize>
+volatile uint8_t HwUart<baud, rxBufSize, txBufSize>::txTail;
+
+#endif
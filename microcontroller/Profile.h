@@ -0,0 +1,134 @@
+// Profile.h
+// Optional counters that show how busy the firmware is: how often the
+// interrupts run and how long they take, how long interrupts stay
+// disabled, and how long each command keeps the main loop. They are
+// only compiled in with FRUGAL_PROFILE defined, see the prof command
+// in main.cpp; otherwise this file is not even included.
+//
+// Short durations are measured in CPU cycles by reading Timer1 at
+// both ends. Timer1 has to run freely from 0 to the given top with the
+// given prescaler, so a duration is only known modulo the timer
+// period. That is a few times the sampling period of the software
+// UART, and an interrupt that took longer would have missed samples
+// anyway. The prologue and epilogue that the compiler adds to an
+// interrupt are not included, but time spent in interrupts nested into
+// the measured section is.
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include "Protocol.h"
+#include <avr/io.h>
+
+template<unsigned int top, unsigned int prescale>
+class Profiler
+{
+ public:
+    enum Isr : uint8_t { uartIsr, tickIsr, isrCount };
+
+    struct IsrCounter
+    {
+	unsigned long count;
+	unsigned int maxCycles;
+    };
+
+    // Commands are timed by the caller, in microseconds.
+    struct CommandCounter
+    {
+	unsigned int count;
+	unsigned long maxUs;
+    };
+
+    struct State
+    {
+	IsrCounter isr[isrCount];
+	unsigned int maxIrqOffCycles;
+	CommandCounter commands[frugal::protocol::commandCount];
+    };
+
+    // Measures an interrupt for as long as it is in scope. A blocking
+    // interrupt also counts as a section with interrupts disabled.
+    class IsrScope
+    {
+     public:
+	IsrScope(Isr isr, bool blocking)
+	    : isr_(isr), blocking_(blocking), start_(TCNT1) {}
+
+	~IsrScope()
+	{
+	    unsigned int cycles = cyclesSince(start_);
+	    IsrCounter& counter = s.isr[isr_];
+	    ++counter.count;
+	    if (cycles > counter.maxCycles)
+		counter.maxCycles = cycles;
+	    if (blocking_ && cycles > s.maxIrqOffCycles)
+		s.maxIrqOffCycles = cycles;
+	}
+
+     private:
+	Isr isr_;
+	bool blocking_;
+	unsigned int start_;
+    };
+
+    // Measures a section that runs with interrupts disabled. It must
+    // be created and destroyed with interrupts off.
+    class IrqOffScope
+    {
+     public:
+	IrqOffScope() : start_(TCNT1) {}
+
+	~IrqOffScope()
+	{
+	    unsigned int cycles = cyclesSince(start_);
+	    if (cycles > s.maxIrqOffCycles)
+		s.maxIrqOffCycles = cycles;
+	}
+
+	// Lets the scope be the variable of a for loop that runs once.
+	bool pending = true;
+
+     private:
+	unsigned int start_;
+    };
+
+    static void commandDone(uint8_t op, unsigned long us)
+    {
+	CommandCounter& counter = s.commands[op];
+	if (counter.count != (unsigned int)~0)
+	    ++counter.count;
+	if (us > counter.maxUs)
+	    counter.maxUs = us;
+    }
+
+    // The interrupt counters must be read with interrupts off.
+    static const IsrCounter& isr(Isr which)
+    {
+	return s.isr[which];
+    }
+
+    static unsigned int maxIrqOffCycles()
+    {
+	return s.maxIrqOffCycles;
+    }
+
+    static const CommandCounter& command(uint8_t op)
+    {
+	return s.commands[op];
+    }
+
+ private:
+    static unsigned int cyclesSince(unsigned int start)
+    {
+	unsigned int now = TCNT1;
+	unsigned int counts = now >= start ? now - start : now + (top + 1U) - start;
+	return counts * prescale;
+    }
+
+    static State s;
+};
+
+template<unsigned int top, unsigned int prescale>
+typename Profiler<top, prescale>::State Profiler<top, prescale>::s;
+
+#endif
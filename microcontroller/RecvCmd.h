@@ -20,6 +20,14 @@ class RecvCmd
 	cmdStrings[numCmds++] = cmdstring;
     }
 
+    // Use a whole table of commands, without copying it into RAM. The
+    // table as well as the strings must be stored in PROGMEM. Use
+    // maxCommands of 0 with this.
+    void setCommands_P(const char* const* table, byte n) {
+	cmdTable_P = table;
+	numCmds = n;
+    }
+
     // Resets the command buffer.
     void reset() {
 	lastChar = 0;
@@ -53,6 +61,9 @@ class RecvCmd
 	return lastChar;
     }
 
+    // The most characters the buffer holds before it wraps around.
+    static constexpr byte capacity = recvBufferSize;
+
     // Get the list of known commands.
     const char* commands() const {
 	return cmdStrings;
@@ -68,6 +79,7 @@ private:
     byte lastChar;
     bool awaitNewline;
     const char* cmdStrings[maxCommands];
+    const char* const* cmdTable_P = nullptr;
     byte numCmds = 0;
 };
 
@@ -89,6 +101,13 @@ char RecvCmd<recvBufferSize, maxCommands>::addChar(char c)
 		    return i;
 		}
 	    }
+	} else if (cmdTable_P) {
+	    for (byte i = 0; i < numCmds; ++i) {
+		const char* cmdString = (const char*)pgm_read_ptr(&cmdTable_P[i]);
+		if (0 == strcmp_P(cmd, cmdString)) {
+		    return i;
+		}
+	    }
 	}
 	// None found, error out.
 	return -2;
@@ -0,0 +1,390 @@
+// SoftUart.h
+// Software UART on Timer0 as a C++ template. The baud rate, pins and
+// buffer size are template arguments, so the timer settings are
+// computed and checked at compile time and the pin accesses in the
+// interrupt compile to single instructions through FastPin.
+//
+// Based on the generic software uart by Colin Gittins, ported to AVR
+// by Martin Thomas, Kaiserslautern, Germany
+// <eversmith@heizung-thomas.de>
+// http://www.siwawi.arubi.uni-kl.de/avr_projects
+//
+// The timer interrupts at three times the baud rate, but only while a
+// character is being sent or received. The transmitter shifts out a
+// bit on every third interrupt. The start bit of a received character
+// is detected by a pin change interrupt on the Rx pin, which then
+// hands over to the timer to sample each bit in its middle. An idle
+// line thus costs no interrupts at all.
+//
+// How the timer is driven is up to the Timer argument. The default,
+// SoftUartTimer0, has Timer0 to itself. A firmware that uses Timer0
+// for other things too can pass a class with the same functions and
+// call isr() from its own timer interrupt.
+
+/* Copyright (c) 2003, Colin Gittins
+   Copyright (c) 2005, 2007, 2010, Martin Thomas
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions are met:
+
+   * Redistributions of source code must retain the above copyright
+     notice, this list of conditions and the following disclaimer.
+
+   * Redistributions in binary form must reproduce the above copyright
+     notice, this list of conditions and the following disclaimer in
+     the documentation and/or other materials provided with the
+     distribution.
+
+   * Neither the name of the copyright holders nor the names of
+     contributors may be used to endorse or promote products derived
+     from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  POSSIBILITY OF SUCH DAMAGE. */
+
+#ifndef SOFT_UART_H
+#define SOFT_UART_H
+
+#include "FastPin.h"
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include <util/atomic.h>
+
+#define SOFTUART_CAT(a, b) SOFTUART_CAT_(a, b)
+#define SOFTUART_CAT_(a, b) a ## b
+
+#if defined (__AVR_ATtiny25__) || defined (__AVR_ATtiny45__) || defined (__AVR_ATtiny85__)
+    #define SOFTUART_T_COMP_LABEL      TIM0_COMPA_vect
+    #define SOFTUART_T_INTCTL_REG      TIMSK
+    #define SOFTUART_T_INTFLAG_REG     TIFR
+
+    #define SOFTUART_PCINT_LABEL       PCINT0_vect
+    #define SOFTUART_PCINT_PORT        0
+    #define SOFTUART_PC_INTCTL_REG     GIMSK
+    #define SOFTUART_PC_INTFLAG_REG    GIFR
+    #define SOFTUART_PC_MASK_REG       PCMSK
+    #define SOFTUART_PCIE              PCIE
+    #define SOFTUART_PCIF              PCIF
+
+namespace softuart_detail {
+constexpr uint8_t pcintPort(uint8_t) { return 0; }
+constexpr uint8_t pcintBit(uint8_t pin) { return pin; }
+}
+#elif defined (__AVR_ATmega328P__) || defined (__AVR_ATmega328__)
+    #define SOFTUART_T_COMP_LABEL      TIMER0_COMPA_vect
+    #define SOFTUART_T_INTCTL_REG      TIMSK0
+    #define SOFTUART_T_INTFLAG_REG     TIFR0
+
+    // Each port has its own pin change interrupt: 0 for port B, 1 for
+    // port C and 2 for port D. Define SOFTUART_PCINT_PORT to the one of
+    // the Rx pin.
+    #if !defined(SOFTUART_PCINT_PORT)
+        #define SOFTUART_PCINT_PORT    2
+    #endif
+    #define SOFTUART_PCINT_LABEL       SOFTUART_CAT(SOFTUART_CAT(PCINT, SOFTUART_PCINT_PORT), _vect)
+    #define SOFTUART_PC_INTCTL_REG     PCICR
+    #define SOFTUART_PC_INTFLAG_REG    PCIFR
+    #define SOFTUART_PC_MASK_REG       SOFTUART_CAT(PCMSK, SOFTUART_PCINT_PORT)
+    #define SOFTUART_PCIE              SOFTUART_CAT(PCIE, SOFTUART_PCINT_PORT)
+    #define SOFTUART_PCIF              SOFTUART_CAT(PCIF, SOFTUART_PCINT_PORT)
+
+// Follows the pin numbering of FastPin.
+namespace softuart_detail {
+#ifdef ARDUINO
+constexpr uint8_t pcintPort(uint8_t pin) { return pin < 8 ? 2 : 0; }
+constexpr uint8_t pcintBit(uint8_t pin) { return pin < 8 ? pin : pin - 8; }
+#else
+constexpr uint8_t pcintPort(uint8_t pin) { return pin < 8 ? 0 : pin < 15 ? 1 : 2; }
+constexpr uint8_t pcintBit(uint8_t pin) { return pin < 8 ? pin : pin < 15 ? pin - 8 : pin - 15; }
+#endif
+}
+#else
+    #error "no defintions available for this AVR"
+#endif
+
+// Defines the interrupts for the given SoftUart type. Use it once, at
+// file scope. The pin change interrupt of the Rx pin's port is taken.
+#define SOFTUART_ISR(uart)					\
+    ISR(SOFTUART_T_COMP_LABEL) { uart::isr(); }			\
+    ISR(SOFTUART_PCINT_LABEL) { uart::pinChangeIsr(); }
+
+// Opens a section that runs with interrupts disabled. A firmware may
+// define it before including this file, e.g. to measure the sections.
+#if !defined(SOFTUART_ATOMIC)
+#define SOFTUART_ATOMIC ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+#endif
+
+// Gives Timer0 to the UART alone. The timer runs continuously in CTC
+// mode, and its interrupt is only enabled while it is needed.
+struct SoftUartTimer0
+{
+    // Called by SoftUart::init() with interrupts off.
+    static void init(uint8_t top, uint8_t clockSelect)
+    {
+	OCR0A = top;
+	TCCR0A = _BV(WGM01);  // CTC mode.
+	TCCR0B = clockSelect;
+	TCNT0 = 0;
+    }
+
+    // Enable the interrupt, ignoring the compare matches that happened
+    // while it was off. If it was off, the counter starts from phase.
+    // Must be called with interrupts off.
+    static void start(uint8_t phase)
+    {
+	if (FAST_GET(SOFTUART_T_INTCTL_REG, OCIE0A))
+	    return;
+	TCNT0 = phase;
+	SOFTUART_T_INTFLAG_REG = _BV(OCF0A);
+	FAST_SET(SOFTUART_T_INTCTL_REG, OCIE0A);
+    }
+
+    // Called by the interrupt when there is nothing left to do.
+    static void stop()
+    {
+	FAST_CLR(SOFTUART_T_INTCTL_REG, OCIE0A);
+    }
+};
+
+namespace softuart_detail {
+
+// Timer0 prescalers and their clock select bits.
+constexpr unsigned int prescalers[] = { 1, 8, 64, 256, 1024 };
+constexpr uint8_t clockSelect[] = {
+    _BV(CS00), _BV(CS01), _BV(CS01) | _BV(CS00), _BV(CS02), _BV(CS02) | _BV(CS00)
+};
+
+// The smallest prescaler that fits the sampling period into 8 bits.
+constexpr uint8_t prescalerIndex(unsigned long cycles)
+{
+    uint8_t i = 0;
+    while (i < 4 && cycles > 256UL * prescalers[i])
+	++i;
+    return i;
+}
+
+}
+
+template<unsigned long baud, uint8_t rxPin, uint8_t txPin, uint8_t bufSize = 32,
+	 typename Timer = SoftUartTimer0>
+class SoftUart
+{
+ public:
+    static void init()
+    {
+	s.txBusy = false;
+	s.rxReady = false;
+	s.rxOff = false;
+
+	TxPin::high();  // Avoid garbage on init.
+	TxPin::output();
+	RxPin::input();
+
+	SOFTUART_ATOMIC {
+	    Timer::init(top, softuart_detail::clockSelect[prescaler]);
+	    FAST_SET(SOFTUART_PC_MASK_REG, pcintBit);
+	    FAST_SET(SOFTUART_PC_INTCTL_REG, SOFTUART_PCIE);
+	}
+    }
+
+    static void rxOn()
+    {
+	s.rxOff = false;
+    }
+
+    static void rxOff()
+    {
+	s.rxOff = true;
+    }
+
+    // Tests whether an input character has been received.
+    static bool available()
+    {
+	return s.qin != s.qout;
+    }
+
+    // Reads a character from the input buffer, waiting if necessary.
+    static char get()
+    {
+	while (s.qout == s.qin);
+	char c = s.inbuf[s.qout];
+	s.qout = (s.qout + 1) & (bufSize - 1);
+	return c;
+    }
+
+    static void flushInput()
+    {
+	s.qin = 0;
+	s.qout = 0;
+    }
+
+    static bool transmitBusy()
+    {
+	return s.txBusy;
+    }
+
+    // Writes a character, waiting for the previous one to go out.
+    static void put(char c)
+    {
+	while (s.txBusy);
+	s.txCtr = 3;
+	s.txBitsLeft = 10;  // Start bit, 8 data bits, stop bit.
+	s.txBuffer = ((uint16_t)(uint8_t)c << 1) | 0x200;
+	SOFTUART_ATOMIC {
+	    s.txBusy = true;
+	    Timer::start(0);
+	}
+    }
+
+    static void puts(const char* str)
+    {
+	while (*str)
+	    put(*str++);
+    }
+
+    // Writes a string from program space, e.g. puts_P(PSTR("test")).
+    static void puts_P(const char* str)
+    {
+	char c;
+	while ((c = pgm_read_byte(str++)))
+	    put(c);
+    }
+
+    // The body of the pin change interrupt, see SOFTUART_ISR.
+    static inline void pinChangeIsr() __attribute__((always_inline))
+    {
+	if (RxPin::get() || s.rxOff)
+	    return;
+	// This is the falling edge of the start bit. The pin change
+	// interrupt stays off until the stop bit.
+	FAST_CLR(SOFTUART_PC_MASK_REG, pcintBit);
+	s.rxReady = true;
+	s.rxBuffer = 0;
+	s.rxBitsLeft = 8;
+	s.rxMask = 1;
+	// Sample the first data bit four and a half periods from now, in
+	// the middle of the bit. If the transmitter is using the timer,
+	// its phase is left alone, which makes the sampling up to half a
+	// period late or early.
+	s.rxCtr = 5;
+	Timer::start(top / 2);
+    }
+
+    // The body of the timer interrupt, see SOFTUART_ISR.
+    static inline void isr() __attribute__((always_inline))
+    {
+	// Transmitter section.
+	if (s.txBusy) {
+	    uint8_t ctr = s.txCtr;
+	    if (--ctr == 0) {
+		TxPin::set(s.txBuffer & 1);
+		s.txBuffer >>= 1;
+		ctr = 3;
+		if (--s.txBitsLeft == 0)
+		    s.txBusy = false;
+	    }
+	    s.txCtr = ctr;
+	}
+
+	// Receiver section.
+	if (s.rxWaitingForStop) {
+	    if (--s.rxCtr == 0) {
+		s.rxWaitingForStop = false;
+		s.rxReady = false;
+		// On overflow, the oldest characters are overwritten.
+		uint8_t qin = s.qin;
+		s.inbuf[qin] = s.rxBuffer;
+		s.qin = (qin + 1) & (bufSize - 1);
+		// Watch for the next start bit.
+		SOFTUART_PC_INTFLAG_REG = _BV(SOFTUART_PCIF);
+		FAST_SET(SOFTUART_PC_MASK_REG, pcintBit);
+	    }
+	} else if (s.rxReady) {
+	    uint8_t ctr = s.rxCtr;
+	    if (--ctr == 0) {
+		ctr = 3;
+		if (RxPin::get())
+		    s.rxBuffer |= s.rxMask;
+		s.rxMask <<= 1;
+		if (--s.rxBitsLeft == 0)
+		    s.rxWaitingForStop = true;
+	    }
+	    s.rxCtr = ctr;
+	}
+
+	if (!s.txBusy && !s.rxReady)
+	    Timer::stop();
+    }
+
+ private:
+    using RxPin = FastPin<rxPin>;
+    using TxPin = FastPin<txPin>;
+    static constexpr uint8_t pcintBit = softuart_detail::pcintBit(rxPin);
+
+    // Timer settings for interrupts at three times the baud rate.
+    static constexpr unsigned long cyclesPerSample = (F_CPU + 3 * baud / 2) / (3 * baud);
+    static constexpr uint8_t prescaler = softuart_detail::prescalerIndex(cyclesPerSample);
+    static constexpr unsigned int prescale = softuart_detail::prescalers[prescaler];
+    static constexpr unsigned long top = (cyclesPerSample + prescale / 2) / prescale - 1;
+    // Actual baud rate in thousandths of the requested one.
+    static constexpr unsigned long long baudPermille =
+	F_CPU * 1000ULL / (3ULL * prescale * (top + 1)) / baud;
+
+ public:
+    // While sampling, Timer0 counts from 0 to timerTop, one count every
+    // timerPrescale cycles. A Timer that sets up Timer0 itself has to
+    // use these.
+    static constexpr uint8_t timerTop = top;
+    static constexpr unsigned int timerPrescale = prescale;
+
+ private:
+    // The interrupt takes some 80 cycles at worst, leave the rest of
+    // the CPU something to do.
+    static_assert(cyclesPerSample >= 160, "Baud rate too high for this F_CPU.");
+    static_assert(top <= 0xff, "Baud rate too low for Timer0.");
+    static_assert(baudPermille >= 980 && baudPermille <= 1020,
+		  "Baud rate cannot be reached within 2% with this F_CPU.");
+    static_assert(bufSize && !(bufSize & (bufSize - 1)),
+		  "Buffer size must be a power of two.");
+    static_assert(rxPin != txPin, "Rx and Tx pins must differ.");
+    static_assert(softuart_detail::pcintPort(rxPin) == SOFTUART_PCINT_PORT,
+		  "SOFTUART_PCINT_PORT does not match the Rx pin.");
+
+    struct State
+    {
+	volatile char inbuf[bufSize];
+	volatile uint8_t qin;
+	uint8_t qout;
+	volatile bool rxOff;
+	volatile bool rxReady;
+
+	volatile bool txBusy;
+	volatile uint8_t txCtr;
+	volatile uint8_t txBitsLeft;
+	volatile uint16_t txBuffer;
+
+	// Only used by the interrupt.
+	bool rxWaitingForStop;
+	uint8_t rxMask;
+	uint8_t rxCtr;
+	uint8_t rxBitsLeft;
+	uint8_t rxBuffer;
+    };
+    static State s;
+};
+
+template<unsigned long baud, uint8_t rxPin, uint8_t txPin, uint8_t bufSize, typename Timer>
+typename SoftUart<baud, rxPin, txPin, bufSize, Timer>::State
+SoftUart<baud, rxPin, txPin, bufSize, Timer>::s;
+
+#endif
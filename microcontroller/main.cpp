@@ -6,72 +6,221 @@ vstane, leže, tačko da!
 
 #include "FastPin.h"
 #include "RecvCmd.h"
-extern "C" {
-#include "softuart.h"
-}
+#include "Protocol.h"
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
-#include <util/delay.h>
 #include <avr/interrupt.h>
 #include <avr/pgmspace.h>
+#include <avr/sleep.h>
 #include <util/atomic.h>
 
 using byte = unsigned char;
 using ticks_t = unsigned long;
 
-// Declaration of commands.
+// Timer0 is the only timer. It produces the watchdog tick of
+// timerTick_us by counting periods of about 30 ms, the slow mode. While
+// the software UART samples the line or a pulse pattern is played, it
+// runs in the fast mode instead, at the UART's sampling period or
+// a millisecond. The settings differ between the supported MCUs.
+#if defined (__AVR_ATtiny25__) || defined (__AVR_ATtiny45__) || defined (__AVR_ATtiny85__)
+    #if F_CPU != 8000000UL
+        #error "Timer0 settings assume F_CPU of 8 MHz"
+    #endif
+    #define TIMER0_COMPA_LABEL   TIM0_COMPA_vect
+    #define TIMER0_INTCTL_REG    TIMSK
+    #define TIMER0_INTFLAG_REG   TIFR
+    #define TIMER0_PSR           PSR0
+    // 245 counts of 128 us, 16 periods to a tick.
+    #define TIMER0_SLOW_TOP      244
+    #define TIMER0_SLOW_COUNT_US 128
+    #define TIMER0_TICK_PERIODS  16
+    #define TIMER0_TICK_US       frugal::protocol::attinyTickUs
+    #define TIMER0_CLOCK_US      frugal::protocol::attinyCountUs
+#elif defined (__AVR_ATmega328P__) || defined (__AVR_ATmega328__)
+    #if F_CPU != 16000000UL
+        #error "Timer0 settings assume F_CPU of 16 MHz"
+    #endif
+    #define TIMER0_COMPA_LABEL   TIMER0_COMPA_vect
+    #define TIMER0_INTCTL_REG    TIMSK0
+    #define TIMER0_INTFLAG_REG   TIFR0
+    #define TIMER0_PSR           PSRSYNC
+    // 244 counts of 64 us, 32 periods to a tick. That keeps the tick
+    // of 499712 us that Timer1 made on this MCU, which calibrations
+    // stored in the EEPROM are relative to; 245 counts would give the
+    // ATtiny's 501760 us.
+    #define TIMER0_SLOW_TOP      243
+    #define TIMER0_SLOW_COUNT_US 64
+    #define TIMER0_TICK_PERIODS  32
+    #define TIMER0_TICK_US       frugal::protocol::atmegaTickUs
+    #define TIMER0_CLOCK_US      frugal::protocol::atmegaCountUs
+#else
+    #error "no Timer0 definitions available for this AVR"
+#endif
+
+// The slow mode runs at the largest prescaler.
+static constexpr unsigned int slowPrescale = 1024;
+static_assert(slowPrescale / (F_CPU / 1000000) == TIMER0_SLOW_COUNT_US,
+	      "Slow mode counts do not match the prescaler.");
+
+// Timer0 clock select bits for a prescaler.
+static constexpr unsigned char timer0ClockSelect(unsigned int prescale)
+{
+    return prescale == 1 ? _BV(CS00)
+	: prescale == 8 ? _BV(CS01)
+	: prescale == 64 ? _BV(CS01) | _BV(CS00)
+	: prescale == 256 ? _BV(CS02)
+	: _BV(CS02) | _BV(CS00);
+}
+
+// Switches Timer0 to the given mode, see below.
+static void restartTimer(bool fast, unsigned char phase);
+
+// Profiling counters, built in with FRUGAL_PROFILE, see Profile.h and
+// _cmd_prof(). They count cycles on Timer1, which is otherwise unused.
+// Without FRUGAL_PROFILE, the macros leave nothing behind.
+#if defined(FRUGAL_PROFILE)
+#include "Profile.h"
+#if defined (__AVR_ATtiny25__) || defined (__AVR_ATtiny45__) || defined (__AVR_ATtiny85__)
+// Counts of 16 cycles, wrapping around every 512 us.
+using Profile = Profiler<255, 16>;
+#define PROFILE_INIT() (TCCR1 = _BV(CS12) | _BV(CS10))
+#else
+// Every cycle, wrapping around every 4 ms.
+using Profile = Profiler<65535, 1>;
+#define PROFILE_INIT() (TCCR1A = 0, TCCR1B = _BV(CS10))
+#endif
+#define PROFILE_ISR(isr, blocking) \
+    Profile::IsrScope profileScope(Profile::isr, blocking)
+#define PROFILE_IRQ_OFF() Profile::IrqOffScope profileScope
+#define ATOMIC_SECTION ATOMIC_BLOCK(ATOMIC_RESTORESTATE)	\
+    for (Profile::IrqOffScope profileScope; profileScope.pending; \
+	 profileScope.pending = false)
+#else
+#define PROFILE_INIT()
+#define PROFILE_ISR(isr, blocking)
+#define PROFILE_IRQ_OFF()
+#define ATOMIC_SECTION ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+#endif
+
+// Set while the software UART needs the timer to sample the line.
+static bool uartSampling = false;
+
+// The serial port. The ATmega328P build uses the hardware USART,
+// otherwise a software UART receives on PB1 and transmits on PB0 and
+// is clocked by the Timer0 interrupt below.
+#if defined(HWUART_BAUD_RATE)
+#include "HwUart.h"
+using Uart = HwUart<HWUART_BAUD_RATE>;
+
+// Only pulses need the fast mode, which counts milliseconds.
+static constexpr unsigned char fastTop = F_CPU / 64 / 1000 - 1;
+static constexpr unsigned int fastPrescale = 64;
+#else
+// Its sections with interrupts off are measured like the firmware's.
+#define SOFTUART_ATOMIC ATOMIC_SECTION
+#include "SoftUart.h"
+
+struct UartTimer
+{
+    static void init(uint8_t, uint8_t) {}
+
+    static void start(uint8_t phase)
+    {
+	if (uartSampling)
+	    return;
+	uartSampling = true;
+	restartTimer(true, phase);
+    }
+
+    // The interrupt switches back to the slow mode if it can.
+    static void stop()
+    {
+	uartSampling = false;
+    }
+};
+
+using Uart = SoftUart<2400, 1, 0, 32, UartTimer>;
+
+static constexpr unsigned char fastTop = Uart::timerTop;
+static constexpr unsigned int fastPrescale = Uart::timerPrescale;
+#endif
+
+static_assert(fastPrescale % (F_CPU / 1000000) == 0,
+	      "Fast mode counts are not whole microseconds.");
+static constexpr unsigned char fastCountUs = fastPrescale / (F_CPU / 1000000);
+
+// The interrupts that are not counted still keep the others waiting.
+#if defined(FRUGAL_PROFILE) && defined(HWUART_BAUD_RATE)
+ISR(USART_RX_vect) { PROFILE_ISR(uartIsr, true); Uart::rxIsr(); }
+ISR(USART_UDRE_vect) { PROFILE_IRQ_OFF(); Uart::udreIsr(); }
+#elif defined(HWUART_BAUD_RATE)
+HWUART_ISR(Uart)
+#else
+ISR(SOFTUART_PCINT_LABEL) { PROFILE_IRQ_OFF(); Uart::pinChangeIsr(); }
+#endif
+
+// Declaration of commands, see Protocol.h.
 using CommandFunc = void (*)();
-static void _cmd_setTimeout();
-static void _cmd_start();
-static void _cmd_stop();
-static void _cmd_reset();
-static void _cmd_status();
-static void _cmd_clearmem();
+#define DECLARE_COMMAND(name, argument, length, reply) static void _cmd_ ## name();
+FRUGAL_COMMANDS(DECLARE_COMMAND)
+#undef DECLARE_COMMAND
 
 // Command names to be received.
-static const char _cmd1_string[] PROGMEM = "timeout";
-static const char _cmd2_string[] PROGMEM = "start";
-static const char _cmd3_string[] PROGMEM = "stop";
-static const char _cmd4_string[] PROGMEM = "reset";
-static const char _cmd5_string[] PROGMEM = "status";
-static const char _cmd6_string[] PROGMEM = "clearmem";
-static const char* const commandStrings[] = {
-    _cmd1_string,
-    _cmd2_string,
-    _cmd3_string,
-    _cmd4_string,
-    _cmd5_string,
-    _cmd6_string,
+#define COMMAND_STRING(name, argument, length, reply) \
+    static const char _cmd_ ## name ## _string[] PROGMEM = #name;
+FRUGAL_COMMANDS(COMMAND_STRING)
+#undef COMMAND_STRING
+
+#define COMMAND_STRING_ENTRY(name, argument, length, reply) _cmd_ ## name ## _string,
+static const char* const commandStrings[] PROGMEM = {
+    FRUGAL_COMMANDS(COMMAND_STRING_ENTRY)
 };
+#undef COMMAND_STRING_ENTRY
 
 #define CMDNUM (sizeof(commandStrings) / sizeof(char*))
 
 // The list of commands for easier calling.
+#define COMMAND_ENTRY(name, argument, length, reply) _cmd_ ## name,
 static const CommandFunc commands[] = {
-    _cmd_setTimeout,
-    _cmd_start,
-    _cmd_stop,
-    _cmd_reset,
-    _cmd_status,
-    _cmd_clearmem,
+    FRUGAL_COMMANDS(COMMAND_ENTRY)
 };
+#undef COMMAND_ENTRY
 
-// Sanity check for command list consistency.
+// Sanity checks for command list consistency.
 static_assert(sizeof(commands) / sizeof(CommandFunc) == CMDNUM,
 	      "Sizes of command_strings and commands differ.");
+static_assert(CMDNUM == frugal::protocol::commandCount,
+	      "Command tables differ from the protocol.");
+static_assert(frugal::protocol::maxNameLength() <= 16,
+	      "Command names do not fit into the receive buffer.");
+
+using frugal::protocol::Opcode;
+
+// Whether a receiver holds the longest argument of a command that the
+// host may send, see Protocol.h.
+template<typename Receiver>
+constexpr bool holdsArgument(Opcode op)
+{
+    return Receiver::capacity >= frugal::protocol::info(op).maxLength;
+}
 
 
+// Only the bytes that differ are written, which spares the EEPROM
+// when a large block is flushed repeatedly.
 static void writeEEPROM(byte address, const void* source, byte length)
 {
     const char* sourceBytes = (const char*)source;
     EECR = 0;
     EEAR = address;
     for (byte i = 0; i < length; ++i) {
-        EEDR = sourceBytes[i];
-        FAST_SET(EECR, EEMPE);
-        FAST_SET(EECR, EEPE);
-        while (FAST_GET(EECR, EEPE));
+        FAST_SET(EECR, EERE);
+        if (EEDR != sourceBytes[i]) {
+            EEDR = sourceBytes[i];
+            FAST_SET(EECR, EEMPE);
+            FAST_SET(EECR, EEPE);
+            while (FAST_GET(EECR, EEPE));
+        }
         EEAR = ++address;
     }
 }
@@ -104,34 +253,158 @@ static void readEEPROM(byte address, void* dest, byte length)
     }
 }
 
-static const ticks_t timerTick_us = 499712;
+// Nominal length of a tick, just under half a second.
+static const ticks_t timerTick_us =
+    (TIMER0_SLOW_TOP + 1UL) * TIMER0_SLOW_COUNT_US * TIMER0_TICK_PERIODS;
+static_assert(timerTick_us == TIMER0_TICK_US && TIMER0_SLOW_COUNT_US == TIMER0_CLOCK_US,
+	      "The tick differs from Protocol.h.");
 
 // Set default timeout of one minute.
-static const ticks_t defaultTimeout = 60 * 1000000 / timerTick_us;
+static const unsigned long defaultTimeout = 60;
 
 // Variables shared between subroutines.
 static FastPin<4> ledPin;
 static FastPin<3> resetPin;
-
+static FastPin<2> powerPin;
+// The lines to the machine, released together.
+static FastPinGroup<3, 2> machinePins;
+
+// The internal oscillator is off by a few percent, so the actual
+// length of a tick is measured against the host's clock, see
+// _cmd_clock(). Only estimates within 5% of the nominal tick length
+// are trusted.
+static ticks_t tick_us = timerTick_us;
+static constexpr ticks_t maxTickError_us = timerTick_us / 20;
+
+static unsigned long timeoutSeconds;
 static ticks_t timeoutTicks;
 static ticks_t ticks = 0;
+static volatile bool running = false;
+
+// Timer0 runs continuously and counts ticks since power-on,
+// regardless of whether the watchdog is running.
+static ticks_t clockTicks = 0;
+
+// The time since the last tick is elapsedUs plus the counts since the
+// timer was last restarted or matched, less timerStartUs if it was
+// restarted at a phase. The tick comes in the interrupt in which
+// elapsedUs reaches timerTick_us.
+static bool fastMode = false;
+static unsigned long elapsedUs = 0;
+static unsigned int timerStartUs = 0;
 
 // The timestamp is meant to be seconds from epoch in decimal, but can
-// be anything really.
+// be anything really. If the last heartbeat carried none, the device's
+// own clock is used at the timeout.
 static char lastTimestamp[15];
+static_assert(sizeof(lastTimestamp) > frugal::protocol::info(Opcode::reset).maxLength,
+	      "The reset argument does not fit.");
+
+// Seconds since epoch as set by the host, advanced by the timer in
+// calibrated ticks. The time is epochSeconds + epochUs / 10^6 at the
+// last tick. Zero if the host has not set it since power-on.
+static unsigned long epochSeconds = 0;
+static unsigned long epochUs;
+static unsigned long timeoutEpoch = 0;
+
+// Statistics of the elapsed ticks at each heartbeat. Bucket 0 counts
+// heartbeats that arrived before the first tick, bucket i counts those
+// that arrived after 2^(i-1) to 2^i - 1 ticks. The last bucket also
+// collects everything longer than that. Counts saturate instead of
+// wrapping around.
+static constexpr byte statsBuckets = 12;
+struct HeartbeatStats
+{
+    ticks_t minTicks;
+    ticks_t maxTicks;
+    unsigned int buckets[statsBuckets];
+};
+static HeartbeatStats stats;
+
+// The statistics are kept in RAM and only written to the EEPROM every
+// so often, and when a timeout occurs.
+static constexpr byte statsFlushInterval = 64;
+static byte heartbeatsSinceFlush = 0;
+
+// Set by the timer when a timeout occurs. The timestamp and statistics
+// are then recorded by the main loop, so that the interrupt stays short.
+static volatile bool timedOut = false;
+
+// The pulse pattern that is played on the reset and power lines on a
+// timeout. Each step holds the given lines low for its duration in
+// milliseconds; a step with no lines just waits. The pattern ends at
+// the first step with a zero duration.
+static constexpr byte resetLine = 1;
+static constexpr byte powerLine = 2;
+static constexpr byte maxPulseSteps = 4;
+struct PulseStep
+{
+    byte lines;
+    unsigned int ms;
+};
+static PulseStep pulsePattern[maxPulseSteps];
+static const PulseStep defaultPulsePattern[maxPulseSteps] = {
+    { resetLine, 1000 },
+};
+
+// The pattern is played by the Timer0 interrupt, which runs in the
+// fast mode while a step is pulsing.
+static bool pulsing = false;
+static byte pulseStep;
+static long pulseUsLeft;
 
 // EEPROM addresses.
 static constexpr byte timeoutEEPROMAddr = 0;
 static constexpr byte timestampEEPROMAddr =
-    timeoutEEPROMAddr + sizeof(timeoutTicks);
+    timeoutEEPROMAddr + sizeof(timeoutSeconds);
 static constexpr byte finalEEPROMAddr =
     timestampEEPROMAddr + sizeof(lastTimestamp) + 1;
+static constexpr byte statsEEPROMAddr = finalEEPROMAddr + 1;
+static constexpr byte tickEEPROMAddr = statsEEPROMAddr + sizeof(stats);
+static constexpr byte pulseEEPROMAddr = tickEEPROMAddr + sizeof(tick_us);
+
+// Conversions between seconds and ticks. The tick length is used in
+// units of 64 us, which keeps the arithmetic within 32 bits for
+// timeouts of up to three days. Seconds are rounded up to whole ticks,
+// so that the countdown never ends before the timeout, see _cmd_start().
+static ticks_t secondsToTicks(unsigned long seconds)
+{
+    ticks_t unit = tick_us / 64;
+    return (seconds * (1000000 / 64) + unit - 1) / unit;
+}
+
+static unsigned long ticksToSeconds(ticks_t t)
+{
+    return t * (tick_us / 64) / (1000000 / 64);
+}
+
+static void updateTimeoutTicks()
+{
+    ticks_t t = secondsToTicks(timeoutSeconds);
+    ATOMIC_SECTION {
+	timeoutTicks = t;
+    }
+}
+
+static void recordTimeout();
+static void readClock(ticks_t& tick, unsigned long& us);
+
+#if defined(FRUGAL_PROFILE)
+// Microseconds since power-on, wrapping around, for timing commands.
+static unsigned long clockUs()
+{
+    ticks_t tick;
+    unsigned long us;
+    readClock(tick, us);
+    return tick * timerTick_us + us;
+}
+#endif
 
 
 int main()
 {
-    resetPin.low();
-    resetPin.input();
+    machinePins.low();
+    machinePins.input();
     ledPin.low();
     ledPin.output();
 
@@ -142,34 +415,73 @@ int main()
 	_cmd_clearmem();
     }
 
-    readEEPROM(timeoutEEPROMAddr, &timeoutTicks, sizeof(timeoutTicks));
-
-    softuart_init();
-
-    // Setup Timer1.
-    TCCR1 = 15;  // Prescaler period 2^14.
-    FAST_SET(TCCR1, CTC1);  // CTC mode with OCR1C register.
-    // Set the counter interval to 244, which produces the period of
-    // just under half a second (timerTick_us).
-    OCR1C = 244;
-    OCR1A = 244;
-    // Timer1 interrupt will only be enabled once the timeout is known.
-
+    readEEPROM(timeoutEEPROMAddr, &timeoutSeconds, sizeof(timeoutSeconds));
+    readEEPROM(statsEEPROMAddr, &stats, sizeof(stats));
+    // A fresh EEPROM holds no valid calibration.
+    readEEPROM(tickEEPROMAddr, &tick_us, sizeof(tick_us));
+    if (tick_us < timerTick_us - maxTickError_us
+	|| tick_us > timerTick_us + maxTickError_us)
+	tick_us = timerTick_us;
+    updateTimeoutTicks();
+    // Neither is there a pulse pattern in an EEPROM written by older
+    // firmware.
+    readEEPROM(pulseEEPROMAddr, pulsePattern, sizeof(pulsePattern));
+    if (pulsePattern[0].lines > (resetLine | powerLine) || !pulsePattern[0].ms)
+	memcpy(pulsePattern, defaultPulsePattern, sizeof(pulsePattern));
+
+    Uart::init();
+    PROFILE_INIT();
+
+    // Start in the slow mode. The interrupt is always enabled.
+    TCCR0A = _BV(WGM01);  // CTC mode.
+    OCR0A = TIMER0_SLOW_TOP;
+    TCCR0B = timer0ClockSelect(slowPrescale);
+    FAST_SET(TIMER0_INTCTL_REG, OCIE0A);
+
+    // Timers keep running in idle sleep.
+    set_sleep_mode(SLEEP_MODE_IDLE);
     sei();
 
-    RecvCmd<16, CMDNUM> cmdReceiver;
-    for (byte i = 0; i < CMDNUM; ++i) {
-	cmdReceiver.addCommand_P(commandStrings[i]);
-    }
+    RecvCmd<16, 0> cmdReceiver;
+    cmdReceiver.setCommands_P(commandStrings, CMDNUM);
 
-    softuart_turn_rx_on();
+    Uart::rxOn();
     for (;;) {
-	auto status = cmdReceiver.addChar(softuart_getchar());
+	if (timedOut) {
+	    timedOut = false;
+	    recordTimeout();
+	}
+	// Sleep until an interrupt if there is nothing to do. Interrupts
+	// are only enabled right before sleeping, so that one that comes
+	// in between wakes us up.
+	cli();
+	bool idle;
+	{
+	    PROFILE_IRQ_OFF();
+	    idle = !timedOut && !Uart::available();
+	    if (idle)
+		sleep_enable();
+	}
+	sei();
+	if (idle) {
+	    sleep_cpu();
+	    sleep_disable();
+	    continue;
+	}
+	if (!Uart::available())
+	    continue;
+	auto status = cmdReceiver.addChar(Uart::get());
 	if (status == -2) {
-	    softuart_puts_P("Invalid command!\n\r");
+	    Uart::puts_P(PSTR("Invalid command!\n\r"));
 	    cmdReceiver.reset();
 	} else if (status >= 0) {
+#if defined(FRUGAL_PROFILE)
+	    unsigned long start = clockUs();
 	    commands[(byte)status]();
+	    Profile::commandDone(status, clockUs() - start);
+#else
+	    commands[(byte)status]();
+#endif
 	    cmdReceiver.reset();
 	}
     }
@@ -177,44 +489,197 @@ int main()
     return 0;
 }
 
-ISR(TIM1_COMPA_vect, ISR_NOBLOCK)
+static void flushStats()
+{
+    heartbeatsSinceFlush = 0;
+    writeEEPROM(statsEEPROMAddr, &stats, sizeof(stats));
+}
+
+static void recordTimeout()
+{
+    if (!lastTimestamp[0] && timeoutEpoch)
+	ultoa(timeoutEpoch, lastTimestamp, 10);
+    byte n = strlen(lastTimestamp);
+    write1EEPROM(timestampEEPROMAddr + n, 0);
+    writeEEPROM(timestampEEPROMAddr, lastTimestamp, n);
+    flushStats();
+}
+
+static void recordHeartbeat(ticks_t elapsed)
+{
+    if (elapsed < stats.minTicks)
+	stats.minTicks = elapsed;
+    if (elapsed > stats.maxTicks)
+	stats.maxTicks = elapsed;
+
+    byte bucket = 0;
+    for (; elapsed && bucket < statsBuckets - 1; elapsed >>= 1)
+	++bucket;
+    if (stats.buckets[bucket] != (unsigned int)~0)
+	++stats.buckets[bucket];
+
+    if (++heartbeatsSinceFlush >= statsFlushInterval)
+	flushStats();
+}
+
+static inline byte timerCountUs()
+{
+    return fastMode ? fastCountUs : TIMER0_SLOW_COUNT_US;
+}
+
+static inline unsigned int timerPeriodUs()
+{
+    return fastMode ? (fastTop + 1U) * fastCountUs
+	: (TIMER0_SLOW_TOP + 1U) * TIMER0_SLOW_COUNT_US;
+}
+
+// The microseconds that Timer0 has counted since it was last restarted
+// or matched. Must be called with interrupts off.
+static unsigned int timerUs()
+{
+    byte count = TCNT0;
+    unsigned int us = count * timerCountUs();
+    // The counter may have wrapped while interrupts were disabled.
+    if (FAST_GET(TIMER0_INTFLAG_REG, OCF0A) && count < OCR0A / 2)
+	us += timerPeriodUs();
+    return us - timerStartUs;
+}
+
+// Read the time since power-on as whole ticks and microseconds since
+// the last tick.
+static void readClock(ticks_t& tick, unsigned long& us)
 {
+    ATOMIC_SECTION {
+	tick = clockTicks;
+	us = elapsedUs + timerUs();
+    }
+    // The interrupt may not have seen the last tick yet.
+    if (us >= timerTick_us) {
+	us -= timerTick_us;
+	++tick;
+    }
+}
+
+// Counts time that has passed on the timer.
+static void advance(unsigned int us)
+{
+    elapsedUs += us;
+    if (pulsing)
+	pulseUsLeft -= us;
+}
+
+// Restart Timer0 in the fast or the slow mode, with the counter at
+// phase. The counts of the old mode are kept, but the one in progress
+// is lost with the prescaler and taken as half a count. Must be called
+// with interrupts off.
+static void restartTimer(bool fast, byte phase)
+{
+    advance(timerUs() + timerCountUs() / 2);
+    fastMode = fast;
+    timerStartUs = phase * timerCountUs();
+    TCCR0B = 0;
+    TCNT0 = phase;
+    OCR0A = fast ? fastTop : TIMER0_SLOW_TOP;
+    TIMER0_INTFLAG_REG = _BV(OCF0A);
+    FAST_SET(GTCCR, TIMER0_PSR);
+    TCCR0B = timer0ClockSelect(fast ? fastPrescale : slowPrescale);
+}
+
+// Release the lines and start the given step of the pulse pattern, or
+// stop if the pattern has ended. Must be called with interrupts off.
+static void startPulseStep(byte step)
+{
+    machinePins.input();
+    if (step >= maxPulseSteps || !pulsePattern[step].ms) {
+	pulsing = false;
+	return;
+    }
+    pulseStep = step;
+    byte lines = pulsePattern[step].lines;
+    if (lines & resetLine)
+	resetPin.output();
+    if (lines & powerLine)
+	powerPin.output();
+    pulseUsLeft = pulsePattern[step].ms * 1000L;
+    pulsing = true;
+    if (!fastMode)
+	restartTimer(true, 0);
+}
+
+static void tick()
+{
+    ++clockTicks;
+    if (epochSeconds) {
+	epochUs += tick_us;
+	if (epochUs >= 1000000) {
+	    epochUs -= 1000000;
+	    ++epochSeconds;
+	}
+    }
+    if (!running)
+	return;
     ledPin.toggle();
     if (++ticks > timeoutTicks) {
-	// Timeout occured, record the timestamp and reset the machine.
-	FAST_CLR(TIMSK, OCIE1A);
+	// Timeout occured, reset the machine. The main loop records the
+	// timestamp.
+	running = false;
 	ticks = timeoutTicks;
-	byte n = strlen(lastTimestamp);
-	write1EEPROM(timestampEEPROMAddr + n, 0);
-	writeEEPROM(timestampEEPROMAddr, lastTimestamp, n);
+	timedOut = true;
+	timeoutEpoch = epochSeconds;
 	ledPin.high();
-	resetPin.output();
-	_delay_ms(1000);
-	resetPin.input();
+	startPulseStep(0);
     }
 }
 
-static void _cmd_setTimeout()
+// Samples the line first, as that is the part that must not be late,
+// then does whatever else is due.
+ISR(TIMER0_COMPA_LABEL)
+{
+    PROFILE_ISR(tickIsr, true);
+#if !defined(HWUART_BAUD_RATE)
+    if (uartSampling) {
+	PROFILE_ISR(uartIsr, false);
+	Uart::isr();
+    }
+#endif
+    advance(timerPeriodUs() - timerStartUs);
+    timerStartUs = 0;
+    if (pulsing && pulseUsLeft <= 0)
+	startPulseStep(pulseStep + 1);
+    if (elapsedUs >= timerTick_us) {
+	elapsedUs -= timerTick_us;
+	tick();
+    }
+    if (fastMode && !uartSampling && !pulsing)
+	restartTimer(false, 0);
+}
+
+static void _cmd_timeout()
 {
     RecvCmd<10, 0> timeoutReceiver;
-    while (-1 == timeoutReceiver.addChar(softuart_getchar()));
-    unsigned int seconds = strtol(timeoutReceiver.buffer(), 0, 0);
-    timeoutTicks = seconds * 1000000 / timerTick_us;
-    writeEEPROM(timeoutEEPROMAddr, &timeoutTicks, sizeof(timeoutTicks));
+    static_assert(holdsArgument<decltype(timeoutReceiver)>(Opcode::timeout),
+		  "The timeout argument does not fit.");
+    while (-1 == timeoutReceiver.addChar(Uart::get()));
+    timeoutSeconds = strtol(timeoutReceiver.buffer(), 0, 0);
+    writeEEPROM(timeoutEEPROMAddr, &timeoutSeconds, sizeof(timeoutSeconds));
+    updateTimeoutTicks();
 }
 
 static void _cmd_start()
 {
     if (!timeoutTicks)
     	return;
-    TCNT1 = 0;
-    FAST_SET(TIMSK, OCIE1A);  // Interrupt on match with OCR1A.
+    // The timer is not restarted so that the clock keeps running
+    // smoothly. The first tick thus comes anywhere up to a full tick
+    // after the start, and the machine is reset on the tick after
+    // timeoutTicks more, between the timeout and a tick later.
+    running = true;
     ledPin.low();
 }
 
 static void _cmd_stop()
 {
-    FAST_CLR(TIMSK, OCIE1A);
+    running = false;
     ledPin.low();
 }
 
@@ -222,7 +687,7 @@ static void _cmd_reset()
 {
     char c = 0;
     byte i = 0;
-    while ('\r' != (c = softuart_getchar())) {
+    while ('\r' != (c = Uart::get())) {
 	if (c == '\n')
 	    continue;
 	lastTimestamp[i] = c;
@@ -230,48 +695,44 @@ static void _cmd_reset()
     }
     lastTimestamp[i] = 0;
 
-    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    ticks_t elapsed;
+    ATOMIC_SECTION {
+	elapsed = ticks;
 	ticks = 0;
     }
+    // Only heartbeats that arrive while the countdown is running
+    // say something about the host.
+    if (running)
+	recordHeartbeat(elapsed);
 
     // Reset also starts the watchdog. This way, it will also function
     // with no configuration.
     _cmd_start();
 }
 
+// Up to ten digits, as many as an unsigned long has.
 static void printnum(unsigned long number) {
-    char tmp[10];
-    byte i;
-    if (number) {
-	tmp[sizeof(tmp)-1] = 0;
-	for (i = sizeof(tmp)-2; i > 0 && number > 0; --i) {
-	    tmp[i] = '0' + number % 10;
-	    number /= 10;
-	}
-	softuart_puts(tmp + i + 1);
-    } else {
-	softuart_putchar('0');
-    }
+    char tmp[11];
+    Uart::puts(ultoa(number, tmp, 10));
 }
 
 static void _cmd_status()
 {
     ticks_t elapsed;
-    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    ATOMIC_SECTION {
 	elapsed = ticks;
     }
-    elapsed = elapsed * timerTick_us / 1000000;
-    printnum(elapsed);
-    softuart_puts_P(" / ");
-    printnum(timeoutTicks * timerTick_us / 1000000);
-    softuart_puts_P("\r\n");
+    printnum(ticksToSeconds(elapsed));
+    Uart::puts_P(PSTR(" / "));
+    printnum(ticksToSeconds(timeoutTicks));
+    Uart::puts_P(PSTR("\r\n"));
 
     // Print the last stored timestamp.
     byte c;
     byte i = timestampEEPROMAddr;
     while ((c = read1EEPROM(i++)))
-	softuart_putchar(c);
-    softuart_puts_P("\r\n");
+	Uart::put(c);
+    Uart::puts_P(PSTR("\r\n"));
 }
 
 static void _cmd_clearmem()
@@ -279,4 +740,221 @@ static void _cmd_clearmem()
     writeEEPROM(timeoutEEPROMAddr, &defaultTimeout, sizeof(defaultTimeout));
     write1EEPROM(timestampEEPROMAddr, 0);
     write1EEPROM(finalEEPROMAddr, 0);
+    memcpy(pulsePattern, defaultPulsePattern, sizeof(pulsePattern));
+    writeEEPROM(pulseEEPROMAddr, pulsePattern, sizeof(pulsePattern));
+
+    memset(&stats, 0, sizeof(stats));
+    stats.minTicks = ~(ticks_t)0;
+    flushStats();
+}
+
+static void _cmd_stats()
+{
+    unsigned long count = 0;
+    for (byte i = 0; i < statsBuckets; ++i)
+	count += stats.buckets[i];
+    printnum(count);
+    Uart::put(' ');
+    printnum(count ? stats.minTicks : 0);
+    Uart::put(' ');
+    printnum(stats.maxTicks);
+    Uart::puts_P(PSTR("\r\n"));
+
+    for (byte i = 0; i < statsBuckets; ++i) {
+	if (i)
+	    Uart::put(' ');
+	printnum(stats.buckets[i]);
+    }
+    Uart::puts_P(PSTR("\r\n"));
+}
+
+static void _cmd_ping()
+{
+    RecvCmd<10, 0> seqReceiver;
+    static_assert(holdsArgument<decltype(seqReceiver)>(Opcode::ping),
+		  "The ping argument does not fit.");
+    while (-1 == seqReceiver.addChar(Uart::get()));
+    ticks_t tick;
+    unsigned long us;
+    readClock(tick, us);
+    Uart::puts(seqReceiver.buffer());
+    Uart::put(' ');
+    printnum(tick);
+    Uart::put(' ');
+    printnum(us);
+    Uart::puts_P(PSTR("\r\n"));
+}
+
+// Host time references for calibrating the tick length. When two
+// references arrive between calibrationMinMs and calibrationMaxMs
+// apart, the tick length is recalculated from them. References that
+// come too soon are ignored so that the host can send them as often
+// as it likes.
+static constexpr unsigned long calibrationMinMs = 5 * 60000UL;
+static constexpr unsigned long calibrationMaxMs = 15 * 60000UL;
+static bool haveReference = false;
+static unsigned long refHostMs;
+static ticks_t refTick;
+static unsigned long refUs;
+
+// The measured tick is timerTick_us * hostMs / deviceMs. The division
+// is done in two steps to fit into 32 bits for up to calibrationMaxMs.
+static void calibrate(unsigned long hostMs, unsigned long deviceMs)
+{
+    static_assert(timerTick_us % 128 == 0, "Nominal tick must be a multiple of 128 us.");
+    static_assert(calibrationMaxMs * (timerTick_us / 128) / calibrationMaxMs
+		  == timerTick_us / 128, "Calibration interval too long.");
+    unsigned long x = hostMs * (timerTick_us / 128);
+    ticks_t t = x / deviceMs * 128 + x % deviceMs * 128 / deviceMs;
+    if (t < timerTick_us - maxTickError_us || t > timerTick_us + maxTickError_us)
+	return;
+    ATOMIC_SECTION {
+	tick_us = t;
+    }
+    updateTimeoutTicks();
+
+    // Only store the new value if it differs by more than 50 ppm, to
+    // spare the EEPROM.
+    ticks_t stored;
+    readEEPROM(tickEEPROMAddr, &stored, sizeof(stored));
+    ticks_t diff = t > stored ? t - stored : stored - t;
+    if (diff > t / 20000)
+	writeEEPROM(tickEEPROMAddr, &tick_us, sizeof(tick_us));
+}
+
+static void _cmd_clock()
+{
+    RecvCmd<11, 0> timeReceiver;
+    static_assert(holdsArgument<decltype(timeReceiver)>(Opcode::clock),
+		  "The clock argument does not fit.");
+    while (-1 == timeReceiver.addChar(Uart::get()));
+    unsigned long hostMs = strtoul(timeReceiver.buffer(), 0, 10);
+    ticks_t tick;
+    unsigned long us;
+    readClock(tick, us);
+
+    // The host time may wrap around, but differences are still fine.
+    unsigned long hostElapsed = hostMs - refHostMs;
+    if (haveReference) {
+	if (hostElapsed < calibrationMinMs)
+	    return;
+	if (hostElapsed <= calibrationMaxMs) {
+	    unsigned long deviceElapsed =
+		((tick - refTick) * timerTick_us + us - refUs) / 1000;
+	    calibrate(hostElapsed, deviceElapsed);
+	}
+    }
+    haveReference = true;
+    refHostMs = hostMs;
+    refTick = tick;
+    refUs = us;
+}
+
+// The pattern is given as steps of a letter and a duration in
+// milliseconds, e.g. "P5000 W2000 P200". R pulls the reset line, P the
+// power line, B both, and W waits.
+static void _cmd_pulse()
+{
+    RecvCmd<32, 0> patternReceiver;
+    static_assert(holdsArgument<decltype(patternReceiver)>(Opcode::pulse),
+		  "The pulse argument does not fit.");
+    while (-1 == patternReceiver.addChar(Uart::get()));
+
+    PulseStep pattern[maxPulseSteps] = {};
+    const char* p = patternReceiver.buffer();
+    for (byte i = 0; *p; ++i) {
+	byte lines;
+	switch (*p++) {
+	case 'R': lines = resetLine; break;
+	case 'P': lines = powerLine; break;
+	case 'B': lines = resetLine | powerLine; break;
+	case 'W': lines = 0; break;
+	default: lines = 0; i = maxPulseSteps;
+	}
+	char* end;
+	unsigned long ms = strtoul(p, &end, 10);
+	if (i >= maxPulseSteps || end == p || !ms || ms > 0xffff) {
+	    Uart::puts_P(PSTR("Invalid pattern!\r\n"));
+	    return;
+	}
+	pattern[i].lines = lines;
+	pattern[i].ms = ms;
+	for (p = end; *p == ' '; ++p);
+    }
+    if (!pattern[0].ms) {
+	Uart::puts_P(PSTR("Invalid pattern!\r\n"));
+	return;
+    }
+
+    // A pattern that is being played keeps going with the new steps.
+    ATOMIC_SECTION {
+	memcpy(pulsePattern, pattern, sizeof(pulsePattern));
+    }
+    writeEEPROM(pulseEEPROMAddr, pulsePattern, sizeof(pulsePattern));
+}
+
+// Sets the time in seconds since epoch, or prints it if the argument
+// is empty.
+static void _cmd_epoch()
+{
+    RecvCmd<11, 0> epochReceiver;
+    static_assert(holdsArgument<decltype(epochReceiver)>(Opcode::epoch),
+		  "The epoch argument does not fit.");
+    while (-1 == epochReceiver.addChar(Uart::get()));
+    unsigned long seconds = strtoul(epochReceiver.buffer(), 0, 10);
+    ticks_t tick;
+    unsigned long us;
+    if (!seconds) {
+	ATOMIC_SECTION {
+	    readClock(tick, us);
+	    seconds = epochSeconds;
+	    us += epochUs;
+	}
+	printnum(seconds ? seconds + us / 1000000 : 0);
+	Uart::puts_P(PSTR("\r\n"));
+	return;
+    }
+
+    // The time is counted from the last tick, which was a moment ago.
+    ATOMIC_SECTION {
+	readClock(tick, us);
+	epochSeconds = seconds - 1;
+	epochUs = 1000000 - us;
+    }
+}
+
+#if defined(FRUGAL_PROFILE)
+// Prints the profiling counters since power-on, see Protocol.h.
+// Cycles are counted in steps of the Timer1 prescaler, and commands
+// are timed by the clock of readClock().
+static void _cmd_prof()
+{
+    for (byte i = 0; i < Profile::isrCount; ++i) {
+	Profile::IsrCounter isr;
+	ATOMIC_SECTION {
+	    isr = Profile::isr((Profile::Isr)i);
+	}
+	printnum(isr.count);
+	Uart::put(' ');
+	printnum(isr.maxCycles);
+	Uart::put(' ');
+    }
+    unsigned int maxIrqOffCycles;
+    ATOMIC_SECTION {
+	maxIrqOffCycles = Profile::maxIrqOffCycles();
+    }
+    printnum(maxIrqOffCycles);
+    Uart::puts_P(PSTR("\r\n"));
+
+    // Only the main loop updates these.
+    for (byte i = 0; i < CMDNUM; ++i) {
+	if (i)
+	    Uart::put(' ');
+	const Profile::CommandCounter& command = Profile::command(i);
+	printnum(command.count);
+	Uart::put(' ');
+	printnum(command.maxUs);
+    }
+    Uart::puts_P(PSTR("\r\n"));
 }
+#endif
@@ -0,0 +1,175 @@
+/*
+  The serial protocol of FrugalWatchdog, shared by the firmware and the
+  host tools.
+
+  A command is its name terminated by CR. A command that takes an
+  argument reads it from the next line, also terminated by CR. Replies
+  are lines terminated by CR LF. Errors are reported with a single line
+  ending in an exclamation mark.
+
+  The commands are listed once, in FRUGAL_COMMANDS, as
+  X(name, argument, length, reply), where length is the longest
+  argument the firmware can hold. The firmware expands the list into
+  its dispatch table, so every command needs a handler called
+  _cmd_<name> there, and checks its argument buffers against the
+  lengths. The host tools use the constexpr tables below to encode
+  commands and to know how many lines a reply has.
+
+  Optional commands come last, so that the others keep their opcodes.
+  The host tools know all of them; the firmware only builds them in
+  when enabled, and otherwise answers them as invalid.
+*/
+
+#ifndef FRUGAL_PROTOCOL_H
+#define FRUGAL_PROTOCOL_H
+
+#include <stdint.h>
+
+#define FRUGAL_COMMANDS(X)			\
+    X(timeout,  Number, 10, None)		\
+    X(start,    None,    0, None)		\
+    X(stop,     None,    0, None)		\
+    X(reset,    Text,   14, None)		\
+    X(status,   None,    0, Status)		\
+    X(clearmem, None,    0, None)		\
+    X(stats,    None,    0, Stats)		\
+    X(ping,     Text,   10, Ping)		\
+    X(clock,    Number, 10, None)		\
+    X(pulse,    Text,   32, None)		\
+    X(epoch,    Number, 10, Epoch)		\
+    FRUGAL_PROFILE_COMMANDS(X)
+
+// Built into the firmware with "make PROFILE=1".
+#if defined(FRUGAL_PROFILE) || !defined(__AVR__)
+#define FRUGAL_PROFILE_COMMANDS(X)		\
+    X(prof,     None,    0, Profile)
+#else
+#define FRUGAL_PROFILE_COMMANDS(X)
+#endif
+
+namespace frugal {
+namespace protocol {
+
+enum class Argument : uint8_t
+{
+    None,
+    Number,  // Unsigned decimal that fits into 32 bits; empty queries.
+    Text,    // Anything but CR and LF; may be empty.
+};
+
+// The longest argument of type Number, in digits.
+constexpr uint8_t maxNumberLength = 10;
+
+enum class Reply : uint8_t
+{
+    None,
+    Status,  // "<elapsed> / <timeout>" in seconds, the timeout string.
+    Stats,   // "<count> <min> <max>" in ticks, the histogram buckets.
+    Ping,    // "<argument> <ticks> <microseconds>".
+    Epoch,   // Seconds since epoch, only if the argument was empty.
+    Profile, // "<count> <max cycles>" of the UART and tick interrupts,
+             // the longest time with interrupts disabled in cycles;
+             // "<count> <max microseconds>" of each command in order.
+};
+
+enum class Opcode : uint8_t
+{
+#define FRUGAL_OPCODE(name, argument, length, reply) name,
+    FRUGAL_COMMANDS(FRUGAL_OPCODE)
+#undef FRUGAL_OPCODE
+};
+
+struct CommandInfo
+{
+    const char* name;
+    Argument argument;
+    uint8_t maxLength;  // Of the argument, in characters.
+    Reply reply;
+};
+
+constexpr CommandInfo commands[] = {
+#define FRUGAL_COMMAND_INFO(name, argument, length, reply) \
+    { #name, Argument::argument, length, Reply::reply },
+    FRUGAL_COMMANDS(FRUGAL_COMMAND_INFO)
+#undef FRUGAL_COMMAND_INFO
+};
+
+constexpr uint8_t commandCount = sizeof(commands) / sizeof(commands[0]);
+
+constexpr const CommandInfo& info(Opcode op)
+{
+    return commands[(uint8_t)op];
+}
+
+constexpr uint8_t replyLines(Reply reply)
+{
+    return reply == Reply::Status || reply == Reply::Stats
+	|| reply == Reply::Profile ? 2
+	: reply == Reply::None ? 0 : 1;
+}
+
+// Nominal tick lengths of the firmware and the resolution of the clock
+// that ping reports, in microseconds, see the Timer0 settings in
+// main.cpp.
+constexpr uint32_t attinyTickUs = 501760;
+constexpr uint32_t atmegaTickUs = 499712;
+constexpr uint32_t attinyCountUs = 128;
+constexpr uint32_t atmegaCountUs = 64;
+
+constexpr uint8_t nameLength(const char* name)
+{
+    uint8_t n = 0;
+    while (name[n])
+	++n;
+    return n;
+}
+
+constexpr bool sameName(const char* a, const char* b)
+{
+    while (*a && *a == *b) {
+	++a;
+	++b;
+    }
+    return *a == *b;
+}
+
+constexpr uint8_t maxNameLength()
+{
+    uint8_t max = 0;
+    for (uint8_t i = 0; i < commandCount; ++i) {
+	if (nameLength(commands[i].name) > max)
+	    max = nameLength(commands[i].name);
+    }
+    return max;
+}
+
+constexpr bool namesUnique()
+{
+    for (uint8_t i = 0; i < commandCount; ++i) {
+	for (uint8_t j = i + 1; j < commandCount; ++j) {
+	    if (sameName(commands[i].name, commands[j].name))
+		return false;
+	}
+    }
+    return true;
+}
+
+constexpr bool lengthsMatch()
+{
+    for (uint8_t i = 0; i < commandCount; ++i) {
+	uint8_t length = commands[i].maxLength;
+	if (commands[i].argument == Argument::None ? length != 0
+	    : commands[i].argument == Argument::Number ? length != maxNumberLength
+	    : length == 0)
+	    return false;
+    }
+    return true;
+}
+
+static_assert(namesUnique(), "Command names must be unique.");
+static_assert(lengthsMatch(), "Argument lengths do not match their types.");
+
+}
+}
+
+#endif